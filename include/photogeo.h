@@ -12,6 +12,8 @@
     #define PHOTOGEO_API
 #endif
 
+#include <stddef.h>
+
 // Export C API.
 #ifdef __cplusplus
 extern "C" {
@@ -26,6 +28,9 @@ struct ptg_vec2 {
     unsigned int y;
 };
 
+/// Parent index of outlines not enclosed by any other outline.
+#define PTG_NO_PARENT 0xFFFFFFFFu
+
 /// Vertices representing one continuous edge.
 struct ptg_outline {
     /// Number of vertices.
@@ -33,6 +38,12 @@ struct ptg_outline {
 
     /// Vertex data.
     ptg_vec2* vertices;
+
+    /// Index of the outline in the same layer directly enclosing this one, or PTG_NO_PARENT.
+    unsigned int parent;
+
+    /// Whether the outline bounds a hole in the layer. Holes wind counterclockwise, other outlines clockwise.
+    bool hole;
 };
 
 /// 3-channel color in RGB-space.
@@ -79,6 +90,56 @@ typedef enum {
     PTG_KUWAHARA_FILTER ///< Kuwahara filter.
 } ptg_image_processing_method;
 
+/// Default standard deviation of the Gaussian blur.
+#define PTG_DEFAULT_GAUSSIAN_BLUR_SIGMA 1.5f
+
+/// Default standard deviation in color space of the bilateral filter.
+#define PTG_DEFAULT_BILATERAL_FILTER_SIGMA_COLOR 50.0f
+
+/// Default standard deviation in coordinate space of the bilateral filter.
+#define PTG_DEFAULT_BILATERAL_FILTER_SIGMA_SPACE 5.0f
+
+/// Default aperture size of the median filter.
+#define PTG_DEFAULT_MEDIAN_FILTER_APERTURE 3
+
+/// Default radius of the Kuwahara filter.
+#define PTG_DEFAULT_KUWAHARA_FILTER_RADIUS 2
+
+/// Parameters of the Gaussian blur.
+struct ptg_gaussian_blur_parameters {
+    /// Standard deviation of the Gaussian kernel (PTG_DEFAULT_GAUSSIAN_BLUR_SIGMA). Must be greater than 0, otherwise the blur is skipped.
+    /// The kernel covers three standard deviations on each side, so the cost per pixel grows with sigma.
+    float sigma;
+};
+
+/// Parameters of the bilateral filter.
+struct ptg_bilateral_filter_parameters {
+    /// Standard deviation in color space (PTG_DEFAULT_BILATERAL_FILTER_SIGMA_COLOR).
+    /// Larger values mix colors that are further apart.
+    float sigma_color;
+
+    /// Standard deviation in coordinate space (PTG_DEFAULT_BILATERAL_FILTER_SIGMA_SPACE).
+    /// Larger values mix pixels that are further apart.
+    float sigma_space;
+
+    /// Diameter of the neighborhood of each pixel, or 0 to derive it from sigma_space.
+    /// The cost per pixel grows with the square of the diameter.
+    unsigned int diameter;
+};
+
+/// Parameters of the median filter.
+struct ptg_median_filter_parameters {
+    /// Width and height of the neighborhood of each pixel (PTG_DEFAULT_MEDIAN_FILTER_APERTURE). Must be odd and greater than 1, other values are rounded up to the next odd value of at least 3.
+    unsigned int aperture;
+};
+
+/// Parameters of the Kuwahara filter.
+struct ptg_kuwahara_filter_parameters {
+    /// Radius N, where each of the four quadrants around a pixel is (N+1)x(N+1) pixels (PTG_DEFAULT_KUWAHARA_FILTER_RADIUS).
+    /// The cost per pixel doesn't depend on the radius.
+    unsigned int radius;
+};
+
 /// Parameters regarding the image processing step.
 struct ptg_image_processing_parameters {
     /// The number of image processing methods to use.
@@ -86,6 +147,22 @@ struct ptg_image_processing_parameters {
 
     /// Which methods to use during image processing.
     ptg_image_processing_method* methods;
+
+    /// Parameters of the Gaussian blur. Only used if methods contains PTG_GAUSSIAN_BLUR.
+    ptg_gaussian_blur_parameters gaussian_blur_parameters;
+
+    /// Parameters of the bilateral filter. Only used if methods contains PTG_BILATERAL_FILTER.
+    ptg_bilateral_filter_parameters bilateral_filter_parameters;
+
+    /// Parameters of the median filter. Only used if methods contains PTG_MEDIAN_FILTER.
+    ptg_median_filter_parameters median_filter_parameters;
+
+    /// Parameters of the Kuwahara filter. Only used if methods contains PTG_KUWAHARA_FILTER.
+    ptg_kuwahara_filter_parameters kuwahara_filter_parameters;
+
+    /// Number of threads to run the Kuwahara filter on. The image is split into bands of rows, one per thread.
+    /// 0 or 1 filters the image on the calling thread. The results are identical regardless of thread count.
+    unsigned int thread_count;
 };
 
 /// Method to use to quantize image.
@@ -101,6 +178,30 @@ typedef enum {
 struct ptg_quantization_parameters {
     /// Which method to use to quantize the image.
     ptg_quantization_method quantization_method;
+
+    /// Number of threads to quantize the image on. The image is split into bands of rows, one per thread.
+    /// 0 or 1 quantizes the image on the calling thread. The results are identical regardless of thread count.
+    unsigned int thread_count;
+
+    /// Whether to cache the closest layer of every unique color, so that each color is only compared once.
+    /// Speeds up images with few distinct colors, especially with the CIE methods. The results are identical.
+    /// Has no effect on the euclidean methods, which compare several pixels at a time using SIMD instead.
+    bool cache_colors;
+
+    /// Whether to convert pixels to CIE L*a*b* in single precision with an approximated cube root, several at a time.
+    /// Only affects the CIE methods and is ignored when cache_colors is set. Much faster, but pixels almost equally
+    /// close to two colors may end up in a different layer than with the exact conversion.
+    bool fast_color_conversion;
+};
+
+/// Lookup table mapping every 24-bit color to the layer it is quantized to.
+struct ptg_quantization_lut {
+    /// Number of color layers.
+    unsigned int color_layer_count;
+
+    /// The layer of every color, indexed by (r << 16) | (g << 8) | b.
+    /// Colors closest to a background color map to color_layer_count.
+    unsigned short* entries;
 };
 
 /// Results from the quantization step.
@@ -112,6 +213,28 @@ struct ptg_quantization_results {
     bool** layers;
 };
 
+/// Results from the quantization step, with one bit per pixel.
+struct ptg_packed_quantization_results {
+    /// Number of layers.
+    unsigned int layer_count;
+
+    /// Number of 64-bit words per row. Every row starts on a new word.
+    unsigned int words_per_row;
+
+    /// The color layers. Pixel (x, y) is bit x % 64 of word y * words_per_row + x / 64.
+    /// Unused bits at the end of each row are 0.
+    unsigned long long** layers;
+};
+
+/// Results from the quantization step, with the layer of every pixel in a single image.
+struct ptg_label_quantization_results {
+    /// Number of layers.
+    unsigned int layer_count;
+
+    /// The layer of every pixel. Pixels closest to a background color have the value layer_count.
+    unsigned short* labels;
+};
+
 /// Method to use to trace image.
 typedef enum {
     PTG_MARCHING_SQUARES ///<Marching squares.
@@ -121,6 +244,15 @@ typedef enum {
 struct ptg_tracing_parameters {
     /// Which method to use to trace the image.
     ptg_tracing_method tracing_method;
+
+    /// Number of threads to trace layers on. Each thread traces one layer at a time.
+    /// 0 or 1 traces all layers on the calling thread. The results are identical regardless of thread count.
+    unsigned int thread_count;
+
+    /// Width and height of the tiles to split each layer into, or 0 to trace each layer at once.
+    /// Tiles bound the memory needed while tracing huge layers. Layers are then traced one at a time, with their tiles spread over the threads.
+    /// The results are identical to tracing each layer at once.
+    unsigned int tile_size;
 };
 
 /// Results from the tracing step.
@@ -135,6 +267,29 @@ struct ptg_tracing_results {
     ptg_outline** outlines;
 };
 
+/// Results from the tracing step, with the outlines and vertices of all layers in single buffers.
+/// Takes a fixed number of allocations regardless of the number of outlines.
+struct ptg_contiguous_tracing_results {
+    /// Number of layers.
+    unsigned int layer_count;
+
+    /// Number of outlines per layer.
+    unsigned int* outline_counts;
+
+    /// Index in outlines of the first outline of each layer.
+    unsigned int* outline_offsets;
+
+    /// The outlines of all layers, layer after layer. Their vertices point into vertices.
+    ptg_outline* outlines;
+
+    /// The vertices of all outlines.
+    /// The index of the first vertex of an outline is its vertices pointer minus this pointer.
+    ptg_vec2* vertices;
+};
+
+/// Layer being traced a few rows at a time. Created by ptg_trace_begin.
+struct ptg_trace_stream;
+
 /// Method to use to reduce vertex count.
 typedef enum {
     PTG_NO_VERTEX_REDUCTION, ///< Don't perform any vertex reduction.
@@ -142,11 +297,54 @@ typedef enum {
     PTG_VISVALINGAM_WHYATT ///< Visvalingam-Whyatt.
 } ptg_vertex_reduction_method;
 
+/// Default tolerance for Douglas-Peucker.
+#define PTG_DEFAULT_DOUGLAS_PEUCKER_TOLERANCE 1.8f
+
+/// Default tolerance for Visvalingam-Whyatt.
+#define PTG_DEFAULT_VISVALINGAM_WHYATT_TOLERANCE 20.0f
+
 /// Parameters regarding the vertex reduction step.
 struct ptg_vertex_reduction_parameters {
+    /// Which method to use to reduce vertex count.
     ptg_vertex_reduction_method vertex_reduction_method;
+
+    /// How far the reduced outlines may deviate from the traced outlines, in the units of the vertices.
+    /// For Douglas-Peucker, the largest distance from a removed vertex to the reduced outline (PTG_DEFAULT_DOUGLAS_PEUCKER_TOLERANCE).
+    /// For Visvalingam-Whyatt, the largest area of the triangle a removed vertex forms with its neighbors (PTG_DEFAULT_VISVALINGAM_WHYATT_TOLERANCE).
+    float tolerance;
+
+    /// Tolerance of each layer, overriding tolerance, or null to use tolerance for all layers.
+    /// Must have one value per layer when not null.
+    const float* layer_tolerances;
+
+    /// The most vertices each outline may have, counted as in ptg_outline, or 0 for no limit. Values below 4 (a triangle) are treated as 4.
+    /// After reducing with the vertex reduction method, the vertices forming the smallest triangles with their neighbors are removed until within the limit.
+    unsigned int max_outline_vertex_count;
+
+    /// The most vertices all outlines of a layer may have together, or 0 for no limit.
+    /// Vertices are removed as for max_outline_vertex_count. Outlines reduced to triangles are removed entirely when needed, smallest first.
+    unsigned int max_layer_vertex_count;
+
+    /// Number of threads to reduce outlines on. Outlines are handed out one at a time, longest first.
+    /// 0 or 1 reduces all outlines on the calling thread. The results are identical regardless of thread count.
+    unsigned int thread_count;
+};
+
+/// Allocator to use instead of new and delete.
+struct ptg_allocator {
+    /// Allocate size bytes, aligned for any type. May be called from several threads at once when tracing or reducing vertices on several threads.
+    void* (*alloc)(size_t size, void* user_data);
+
+    /// Free memory allocated with alloc.
+    void (*free)(void* pointer, void* user_data);
+
+    /// Passed to alloc and free.
+    void* user_data;
 };
 
+/// Scratch memory reused between generations. Created with ptg_create_context.
+struct ptg_context;
+
 /// Parameters for generating collision geometry.
 struct ptg_generation_parameters {
     /// Source image parameters.
@@ -163,6 +361,22 @@ struct ptg_generation_parameters {
 
     /// Parameters regarding the vertex reduction step.
     const ptg_vertex_reduction_parameters* vertex_reduction_parameters;
+
+    /// Allocator to allocate layers, outlines and the results with, or null to use new and delete.
+    /// Results have to be freed with ptg_free_results_with_allocator using the same allocator.
+    const ptg_allocator* allocator;
+
+    /// Context to keep scratch memory in between calls, or null to allocate it for this call only.
+    /// Generating from images of the same size again reuses the memory. Scratch memory in a context is allocated with new rather than the allocator.
+    /// This covers the image processing buffers, the packed layers, the traced layers, the quantization color cache and the vertex reduction buffers.
+    /// Not covered are starting worker threads and a few small bookkeeping objects per call, and the memory used to stitch tiles together when tracing in tiles, which grows with the number of outlines.
+    /// A context may only be used by one generation at a time.
+    ptg_context* context;
+
+    /// Number of rows to process and quantize at a time, or 0 to process the whole image before quantizing it.
+    /// Each band is quantized as soon as it has been processed, so the processed image never exists in full and the source image is left unmodified.
+    /// The results are identical either way.
+    unsigned int fused_band_height;
 };
 
 /**
@@ -174,6 +388,18 @@ struct ptg_generation_parameters {
  */
 PHOTOGEO_API void ptg_generate_collision_geometry(const ptg_generation_parameters* parameters, ptg_outline*** out_outlines, unsigned int** out_outline_counts);
 
+/**
+ * Create a context to reuse scratch memory between generations.
+ * @return The context.
+ */
+PHOTOGEO_API ptg_context* ptg_create_context();
+
+/**
+ * Free a context and the scratch memory it keeps.
+ * @param context The context to free.
+ */
+PHOTOGEO_API void ptg_free_context(ptg_context* context);
+
 /**
  * Deallocate the memory that was allocated to store the results.
  * @param layer_count The number of layers.
@@ -182,6 +408,15 @@ PHOTOGEO_API void ptg_generate_collision_geometry(const ptg_generation_parameter
  */
 PHOTOGEO_API void ptg_free_results(unsigned int layer_count, ptg_outline** outlines, unsigned int* outline_counts);
 
+/**
+ * Deallocate the memory that was allocated to store the results using an allocator.
+ * @param allocator The allocator the results were allocated with, or null if they were allocated with new.
+ * @param layer_count The number of layers.
+ * @param outlines The outlines.
+ * @param outline_counts Number of outlines.
+ */
+PHOTOGEO_API void ptg_free_results_with_allocator(const ptg_allocator* allocator, unsigned int layer_count, ptg_outline** outlines, unsigned int* outline_counts);
+
 /**
  * Process image.
  * @param image_parameters Source image parameters.
@@ -203,6 +438,62 @@ PHOTOGEO_API void ptg_quantize(const ptg_image_parameters* image_parameters, con
  */
 PHOTOGEO_API void ptg_free_quantization_results(ptg_quantization_results* quantization_results);
 
+/**
+ * Quantize image into bit-packed layers.
+ * Uses an eighth of the memory of ptg_quantize.
+ * @param image_parameters Source image parameters.
+ * @param quantization_parameters Quantization parameters.
+ * @param out_quantization_results Variable to store quantization results.
+ */
+PHOTOGEO_API void ptg_quantize_packed(const ptg_image_parameters* image_parameters, const ptg_quantization_parameters* quantization_parameters, ptg_packed_quantization_results* out_quantization_results);
+
+/**
+ * Free allocated memory for results during bit-packed quantization.
+ * @param quantization_results Quantization results to free.
+ */
+PHOTOGEO_API void ptg_free_packed_quantization_results(ptg_packed_quantization_results* quantization_results);
+
+/**
+ * Quantize image into a label image.
+ * Uses a fixed two bytes per pixel regardless of the number of layers.
+ * @param image_parameters Source image parameters.
+ * @param quantization_parameters Quantization parameters.
+ * @param out_quantization_results Variable to store quantization results.
+ */
+PHOTOGEO_API void ptg_quantize_labels(const ptg_image_parameters* image_parameters, const ptg_quantization_parameters* quantization_parameters, ptg_label_quantization_results* out_quantization_results);
+
+/**
+ * Free allocated memory for results during label quantization.
+ * @param quantization_results Quantization results to free.
+ */
+PHOTOGEO_API void ptg_free_label_quantization_results(ptg_label_quantization_results* quantization_results);
+
+/**
+ * Create a lookup table to quantize images against a fixed set of colors.
+ * Building the table is expensive, but quantizing with it costs one table lookup per pixel regardless of quantization method.
+ * @param image_parameters Source image parameters. Only the background and color layer colors are used.
+ * @param quantization_parameters Quantization parameters.
+ * @param subsample_bits How many low bits of each channel to skip when sampling colors (0-7).
+ * 0 compares every color. Higher values compare a coarser grid of colors and only refine grid cells whose corners are quantized differently.
+ * This may misquantize colors in regions of a layer that are smaller than a grid cell.
+ * @param out_lut Variable to store the lookup table.
+ */
+PHOTOGEO_API void ptg_create_quantization_lut(const ptg_image_parameters* image_parameters, const ptg_quantization_parameters* quantization_parameters, unsigned int subsample_bits, ptg_quantization_lut* out_lut);
+
+/**
+ * Free allocated memory for a quantization lookup table.
+ * @param lut Lookup table to free.
+ */
+PHOTOGEO_API void ptg_free_quantization_lut(ptg_quantization_lut* lut);
+
+/**
+ * Quantize image using a lookup table.
+ * @param image_parameters Source image parameters. The colors the lookup table was created with are used instead of the ones specified here.
+ * @param lut Lookup table to quantize with.
+ * @param out_quantization_results Variable to store quantization results.
+ */
+PHOTOGEO_API void ptg_quantize_with_lut(const ptg_image_parameters* image_parameters, const ptg_quantization_lut* lut, ptg_quantization_results* out_quantization_results);
+
 /**
  * Trace image.
  * @param image_parameters Source image parameters.
@@ -212,12 +503,86 @@ PHOTOGEO_API void ptg_free_quantization_results(ptg_quantization_results* quanti
  */
 PHOTOGEO_API void ptg_trace(const ptg_image_parameters* image_parameters, const ptg_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_tracing_results* out_tracing_results);
 
+/**
+ * Trace bit-packed image.
+ * @param image_parameters Source image parameters.
+ * @param quantization_results Bit-packed quantization results.
+ * @param tracing_parameters Tracing parameters.
+ * @param out_tracing_results Variable to store tracing results.
+ */
+PHOTOGEO_API void ptg_trace_packed(const ptg_image_parameters* image_parameters, const ptg_packed_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_tracing_results* out_tracing_results);
+
+/**
+ * Trace label image.
+ * @param image_parameters Source image parameters.
+ * @param quantization_results Label quantization results.
+ * @param tracing_parameters Tracing parameters.
+ * @param out_tracing_results Variable to store tracing results.
+ */
+PHOTOGEO_API void ptg_trace_labels(const ptg_image_parameters* image_parameters, const ptg_label_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_tracing_results* out_tracing_results);
+
+/**
+ * Trace image into contiguous results.
+ * @param image_parameters Source image parameters.
+ * @param quantization_results Quantization results.
+ * @param tracing_parameters Tracing parameters.
+ * @param out_tracing_results Variable to store tracing results.
+ */
+PHOTOGEO_API void ptg_trace_contiguous(const ptg_image_parameters* image_parameters, const ptg_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_contiguous_tracing_results* out_tracing_results);
+
+/**
+ * Trace bit-packed image into contiguous results.
+ * @param image_parameters Source image parameters.
+ * @param quantization_results Bit-packed quantization results.
+ * @param tracing_parameters Tracing parameters.
+ * @param out_tracing_results Variable to store tracing results.
+ */
+PHOTOGEO_API void ptg_trace_packed_contiguous(const ptg_image_parameters* image_parameters, const ptg_packed_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_contiguous_tracing_results* out_tracing_results);
+
+/**
+ * Trace label image into contiguous results.
+ * @param image_parameters Source image parameters.
+ * @param quantization_results Label quantization results.
+ * @param tracing_parameters Tracing parameters.
+ * @param out_tracing_results Variable to store tracing results.
+ */
+PHOTOGEO_API void ptg_trace_labels_contiguous(const ptg_image_parameters* image_parameters, const ptg_label_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_contiguous_tracing_results* out_tracing_results);
+
+/**
+ * Start tracing a single layer a few rows at a time using marching squares.
+ * Only the contours still open at the last pushed row are kept in memory, so layers that don't fit in memory whole can be traced.
+ * @param width Width of the layer.
+ * @return The stream to push rows to.
+ */
+PHOTOGEO_API ptg_trace_stream* ptg_trace_begin(unsigned int width);
+
+/**
+ * Trace the next rows of a layer.
+ * @param stream The stream to push rows to.
+ * @param rows Binary layer rows, width values per row.
+ * @param row_count The number of rows.
+ */
+PHOTOGEO_API void ptg_trace_push_rows(ptg_trace_stream* stream, const bool* rows, unsigned int row_count);
+
+/**
+ * Finish tracing a layer. The outlines are identical to tracing the whole layer with ptg_trace.
+ * @param stream The stream to finish. It is deallocated.
+ * @param out_tracing_results Variable to store tracing results, with a single layer.
+ */
+PHOTOGEO_API void ptg_trace_end(ptg_trace_stream* stream, ptg_tracing_results* out_tracing_results);
+
 /**
  * Free allocated memory for results during tracing.
  * @param tracing_results Tracing results to free.
  */
 PHOTOGEO_API void ptg_free_tracing_results(ptg_tracing_results* tracing_results);
 
+/**
+ * Free allocated memory for contiguous results during tracing.
+ * @param tracing_results Tracing results to free.
+ */
+PHOTOGEO_API void ptg_free_contiguous_tracing_results(ptg_contiguous_tracing_results* tracing_results);
+
 /**
  * Reduce vertex count.
  * @param tracing_results Tracing results.
@@ -225,6 +590,14 @@ PHOTOGEO_API void ptg_free_tracing_results(ptg_tracing_results* tracing_results)
  */
 PHOTOGEO_API void ptg_reduce(ptg_tracing_results* tracing_results, const ptg_vertex_reduction_parameters* vertex_reduction_parameters);
 
+/**
+ * Reduce vertex count of contiguous results.
+ * Vertices are reduced in place, leaving unused space in the vertex buffer.
+ * @param tracing_results Contiguous tracing results.
+ * @param vertex_reduction_parameters Vertex reduction parameters.
+ */
+PHOTOGEO_API void ptg_reduce_contiguous(ptg_contiguous_tracing_results* tracing_results, const ptg_vertex_reduction_parameters* vertex_reduction_parameters);
+
 #ifdef __cplusplus
 }
 #endif
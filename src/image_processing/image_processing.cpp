@@ -1,27 +1,129 @@
 #include "image_processing.hpp"
 
+#include <algorithm>
 #include <cstring>
+#include <utility>
 #include "kuwahara.hpp"
 
-void ptgi_image_process(const ptg_image_parameters* image_parameters, const ptg_image_processing_parameters* image_processing_parameters) {
-    cv::Mat src = cv::Mat(image_parameters->height, image_parameters->width, CV_8UC3, image_parameters->image);
-    cv::Mat dst = cv::Mat(image_parameters->height, image_parameters->width, CV_8UC3);
+/*
+ * Get the aperture of the median filter, rounded up to the next odd value of at least 3 as OpenCV requires.
+ * @param median_filter_parameters Parameters of the median filter.
+ * @return The aperture.
+ */
+static unsigned int median_aperture(const ptg_median_filter_parameters& median_filter_parameters) {
+    return std::max(median_filter_parameters.aperture, 3u) | 1;
+}
+
+/*
+ * Apply the image processing methods in order.
+ * Each method reads from one image and writes to the other, which then becomes the source of the next method.
+ * @param image_processing_parameters Parameters regarding which methods to use during image processing.
+ * @param src Image to process.
+ * @param dst Image of the same size to alternate with.
+ * @return The image holding the result, either src or dst.
+ */
+static cv::Mat* filter(const ptg_image_processing_parameters* image_processing_parameters, cv::Mat* src, cv::Mat* dst) {
+    const ptg_bilateral_filter_parameters& bilateral_filter_parameters = image_processing_parameters->bilateral_filter_parameters;
     for (unsigned int i = 0; i < image_processing_parameters->method_count; ++i) {
         switch (image_processing_parameters->methods[i]) {
             case PTG_GAUSSIAN_BLUR:
-                cv::GaussianBlur(src, src, cv::Size(0, 0), 1.5);
+                // OpenCV can't derive a kernel size from a standard deviation that isn't positive.
+                if (image_processing_parameters->gaussian_blur_parameters.sigma <= 0.0f)
+                    continue;
+                cv::GaussianBlur(*src, *dst, cv::Size(0, 0), image_processing_parameters->gaussian_blur_parameters.sigma);
                 break;
             case PTG_BILATERAL_FILTER:
-                cv::bilateralFilter(src, dst, -1, 50, 5, cv::BORDER_DEFAULT);
-                memcpy(image_parameters->image, dst.data, image_parameters->width * image_parameters->height * sizeof(ptg_color));
+                // OpenCV derives the diameter from sigma space when it isn't positive.
+                cv::bilateralFilter(*src, *dst, bilateral_filter_parameters.diameter > 0 ? (int)bilateral_filter_parameters.diameter : -1, bilateral_filter_parameters.sigma_color, bilateral_filter_parameters.sigma_space, cv::BORDER_DEFAULT);
                 break;
             case PTG_MEDIAN_FILTER:
-                cv::medianBlur(src, src, 3);
+                cv::medianBlur(*src, *dst, median_aperture(image_processing_parameters->median_filter_parameters));
                 break;
             case PTG_KUWAHARA_FILTER:
-                kuwahara_filter(src, dst, 2);
-                memcpy(image_parameters->image, dst.data, image_parameters->width * image_parameters->height * sizeof(ptg_color));
+                kuwahara_filter(*src, *dst, image_processing_parameters->kuwahara_filter_parameters.radius, image_processing_parameters->thread_count);
                 break;
+            default:
+                // Unknown methods are ignored, so nothing was written to dst.
+                continue;
         }
+        std::swap(src, dst);
+    }
+
+    return src;
+}
+
+/*
+ * Get how many rows above and below a pixel an image processing method reads.
+ * @param image_processing_parameters Image processing parameters.
+ * @param method The image processing method.
+ * @return The number of rows.
+ */
+static unsigned int filter_radius(const ptg_image_processing_parameters* image_processing_parameters, ptg_image_processing_method method) {
+    switch (method) {
+        case PTG_GAUSSIAN_BLUR:
+            // The blur is skipped when sigma isn't positive.
+            if (image_processing_parameters->gaussian_blur_parameters.sigma <= 0.0f)
+                return 0;
+            // OpenCV uses a kernel size of sigma * 6 + 1, made odd, for 8-bit images.
+            return (cvRound(image_processing_parameters->gaussian_blur_parameters.sigma * 6 + 1) | 1) / 2;
+        case PTG_BILATERAL_FILTER: {
+            // OpenCV uses a radius of sigma space * 1.5 when no diameter is given, and at least 1.
+            const ptg_bilateral_filter_parameters& bilateral_filter_parameters = image_processing_parameters->bilateral_filter_parameters;
+            if (bilateral_filter_parameters.diameter > 0)
+                return std::max(bilateral_filter_parameters.diameter / 2, 1u);
+            const float sigma_space = bilateral_filter_parameters.sigma_space > 0.0f ? bilateral_filter_parameters.sigma_space : 1.0f;
+            return std::max(cvRound(sigma_space * 1.5), 1);
+        }
+        case PTG_MEDIAN_FILTER:
+            return median_aperture(image_processing_parameters->median_filter_parameters) / 2;
+        case PTG_KUWAHARA_FILTER:
+            return image_processing_parameters->kuwahara_filter_parameters.radius;
+    }
+
+    return 0;
+}
+
+void ptgi_image_process(const ptg_image_parameters* image_parameters, const ptg_image_processing_parameters* image_processing_parameters, cv::Mat& buffer) {
+    if (image_processing_parameters->method_count == 0)
+        return;
+
+    cv::Mat image = cv::Mat(image_parameters->height, image_parameters->width, CV_8UC3, image_parameters->image);
+    buffer.create(image_parameters->height, image_parameters->width, CV_8UC3);
+    const cv::Mat* result = filter(image_processing_parameters, &image, &buffer);
+
+    // After an odd number of filters the result is in the buffer. Copy it to the image once at the end.
+    if (result != &image)
+        memcpy(image_parameters->image, result->data, image_parameters->width * image_parameters->height * sizeof(ptg_color));
+}
+
+void ptgi_image_process_bands(const ptg_image_parameters* image_parameters, const ptg_image_processing_parameters* image_processing_parameters, unsigned int band_height, cv::Mat* buffers, const band_writer& write_band) {
+    const unsigned int width = image_parameters->width;
+    const unsigned int height = image_parameters->height;
+
+    // Rows closer to the edge of a band than the methods' combined radius are affected by the edge.
+    // Bands are filtered with that many extra rows above and below, which are then thrown away.
+    unsigned int margin = 0;
+    for (unsigned int i = 0; i < image_processing_parameters->method_count; ++i)
+        margin += filter_radius(image_processing_parameters, image_processing_parameters->methods[i]);
+
+    const unsigned int max_rows = std::min(band_height + 2 * margin, height);
+    for (unsigned int i = 0; i < 2; ++i) {
+        if (buffers[i].rows < (int)max_rows || buffers[i].cols != (int)width)
+            buffers[i].create(max_rows, width, CV_8UC3);
+    }
+
+    for (unsigned int first_row = 0; first_row < height; first_row += band_height) {
+        const unsigned int last_row = std::min(first_row + band_height, height);
+        const unsigned int first_margin_row = (first_row > margin) ? first_row - margin : 0;
+        const unsigned int last_margin_row = std::min(last_row + margin, height);
+        const unsigned int row_count = last_margin_row - first_margin_row;
+
+        // Headers of exactly the band's size, so the filters treat the band's edges as image edges rather than reading past them.
+        cv::Mat src = cv::Mat(row_count, width, CV_8UC3, buffers[0].data);
+        cv::Mat dst = cv::Mat(row_count, width, CV_8UC3, buffers[1].data);
+        memcpy(src.data, image_parameters->image + first_margin_row * width, row_count * width * sizeof(ptg_color));
+
+        const cv::Mat* result = filter(image_processing_parameters, &src, &dst);
+        write_band(first_row, last_row - first_row, reinterpret_cast<const ptg_color*>(result->data) + (first_row - first_margin_row) * width);
     }
 }
@@ -2,12 +2,32 @@
 #define IMAGE_PROCESSING_HPP
 
 #include <photogeo.h>
+#include <functional>
+#include <opencv2/core.hpp>
+
+/*
+ * Function receiving processed bands of rows.
+ * Called with the y-coordinate of the band's first row, the number of rows in the band and the processed rows.
+ */
+typedef std::function<void(unsigned int, unsigned int, const ptg_color*)> band_writer;
 
 /**
  * Process image.
  * @param image_parameters Image input parameters.
  * @param Parameters regarding which methods to use during image processing.
+ * @param buffer Image that filters alternate with the source image to write to. Only reallocated if its size doesn't match the image's.
+ */
+void ptgi_image_process(const ptg_image_parameters* image_parameters, const ptg_image_processing_parameters* image_processing_parameters, cv::Mat& buffer);
+
+/**
+ * Process image one band of rows at a time, leaving the image itself unmodified.
+ * Each band is filtered together with enough rows around it to give the same result as processing the whole image.
+ * @param image_parameters Image input parameters.
+ * @param image_processing_parameters Parameters regarding which methods to use during image processing.
+ * @param band_height Number of rows per band.
+ * @param buffers Two images to filter the bands in. Only reallocated if too small.
+ * @param write_band Function to pass the processed bands to, from the top of the image down. The rows are only valid during the call.
  */
-void ptgi_image_process(const ptg_image_parameters* image_parameters, const ptg_image_processing_parameters* image_processing_parameters);
+void ptgi_image_process_bands(const ptg_image_parameters* image_parameters, const ptg_image_processing_parameters* image_processing_parameters, unsigned int band_height, cv::Mat* buffers, const band_writer& write_band);
 
 #endif
@@ -1,16 +1,15 @@
 #include "kuwahara.hpp"
 
-#include <cstring>
+#include <algorithm>
 #include <limits>
+#include <vector>
+#include "../threading/parallel_for.hpp"
 
-/*
- * Calculate squared length of a vector.
- * @param v The vector.
- * @return Length of the vector.
- */
-static double sqr_length(const cv::Vec3i& v) {
-    return (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
-}
+// Sums of the pixels in a window.
+struct window_sums {
+    long long channels[3];
+    long long sqr;
+};
 
 /*
  * Clamp value.
@@ -25,48 +24,130 @@ T clamp(const T& v, const T& lower, const T& upper) {
 }
 
 /*
- * Calculate mean and variance for a quadrant.
+ * Add or subtract a row of the source image to the column sums of a window.
+ * Only the columns inside the image are updated. See pad_columns.
  * @param src Source image.
- * @param r Row.
- * @param c Column.
+ * @param r Row to add, clamped to the image.
+ * @param kernel_size Size of the kernel N. The columns are padded by N on both sides.
+ * @param sign 1 to add the row, -1 to subtract it.
+ * @param column_sums The column sums to update.
+ */
+static void add_row(const cv::Mat& src, int r, int kernel_size, int sign, std::vector<window_sums>& column_sums) {
+    const cv::Vec3b* row = src.ptr<cv::Vec3b>(clamp(r, 0, src.rows - 1));
+    for (int c = 0; c < src.cols; ++c) {
+        const cv::Vec3b& px = row[c];
+        window_sums& sums = column_sums[c + kernel_size];
+        sums.channels[0] += sign * px[0];
+        sums.channels[1] += sign * px[1];
+        sums.channels[2] += sign * px[2];
+        sums.sqr += sign * (px[0] * px[0] + px[1] * px[1] + px[2] * px[2]);
+    }
+}
+
+/*
+ * Fill the padding columns with the sums of the closest edge column, as if the edge pixels were repeated.
+ * @param kernel_size Size of the kernel N. The columns are padded by N on both sides.
+ * @param column_sums The column sums to pad.
+ */
+static void pad_columns(int kernel_size, std::vector<window_sums>& column_sums) {
+    const int last_column = (int)column_sums.size() - kernel_size - 1;
+    for (int c = 0; c < kernel_size; ++c) {
+        column_sums[c] = column_sums[kernel_size];
+        column_sums[last_column + 1 + c] = column_sums[last_column];
+    }
+}
+
+/*
+ * Calculate prefix sums of column sums, so the sum of any range of columns costs a single subtraction.
+ * @param column_sums The column sums.
+ * @param out_prefix_sums Variable to store the prefix sums in. Has one more element than column_sums.
+ */
+static void prefix_sum(const std::vector<window_sums>& column_sums, std::vector<window_sums>& out_prefix_sums) {
+    for (std::size_t c = 0; c < column_sums.size(); ++c) {
+        for (int channel = 0; channel < 3; ++channel)
+            out_prefix_sums[c + 1].channels[channel] = out_prefix_sums[c].channels[channel] + column_sums[c].channels[channel];
+        out_prefix_sums[c + 1].sqr = out_prefix_sums[c].sqr + column_sums[c].sqr;
+    }
+}
+
+/*
+ * Calculate mean and variance for a quadrant from prefix sums.
+ * Gives the same results as summing the pixels of the quadrant one at a time.
+ * @param prefix_sums Prefix sums of the column sums of the rows the quadrant covers.
+ * @param first_column First padded column of the quadrant.
  * @param kernel_size Size of the kernel N, where the total size is 2*N+1.
- * @param quadrant Current quadrant [1,2,3,4].
  * @param out_mean Variable to store mean.
  * @param out_sqr_variance Variable to store squared variance.
  */
-static void kuwahara_kernel(const cv::Mat& src, int r, int c, int kernel_size, int quadrant, cv::Vec3i& out_mean, double& out_sqr_variance) {
+static void kuwahara_kernel(const std::vector<window_sums>& prefix_sums, int first_column, int kernel_size, cv::Vec3i& out_mean, double& out_sqr_variance) {
+    const window_sums& first = prefix_sums[first_column];
+    const window_sums& last = prefix_sums[first_column + kernel_size + 1];
+    const int count = (kernel_size + 1) * (kernel_size + 1);
+
     // Calculate mean.
-    cv::Vec3i mean = cv::Vec3i(0, 0, 0);
-    int r_start = r - kernel_size * (quadrant == 1 || quadrant == 2);
-    int c_start = c - kernel_size * (quadrant == 2 || quadrant == 3);
-    for (int r_offset = 0; r_offset < kernel_size + 1; ++r_offset)
-        for (int c_offset = 0; c_offset < kernel_size + 1; ++c_offset)
-            mean += src.at<cv::Vec3b>(clamp(r_start + r_offset, 0, src.rows - 1), clamp(c_start + c_offset, 0, src.cols - 1));
-    mean = mean / ((kernel_size + 1) * (kernel_size + 1));
-
-    // Calculate variance.
-    double sqr_variance = 0.0;
-    for (int r_offset = 0; r_offset < kernel_size + 1; ++r_offset) {
-        for (int c_offset = 0; c_offset < kernel_size + 1; ++c_offset) {
-            const cv::Vec3i& px = src.at<cv::Vec3b>(clamp(r_start + r_offset, 0, src.rows - 1), clamp(c_start + c_offset, 0, src.cols - 1));
-            sqr_variance += sqr_length(px - mean);
-        }
-    }
-    sqr_variance = sqr_variance / ((kernel_size + 1) * (kernel_size + 1));
+    const cv::Vec3i sum = cv::Vec3i((int)(last.channels[0] - first.channels[0]), (int)(last.channels[1] - first.channels[1]), (int)(last.channels[2] - first.channels[2]));
+    const cv::Vec3i mean = sum / count;
+
+    // Calculate variance. The sum of (px - mean)^2 is expanded to sum(px^2) - 2 * mean * sum(px) + count * mean^2.
+    long long sqr_difference = last.sqr - first.sqr;
+    for (int channel = 0; channel < 3; ++channel)
+        sqr_difference += (long long)mean[channel] * (count * mean[channel] - 2 * sum[channel]);
 
     out_mean = mean;
-    out_sqr_variance = sqr_variance;
+    out_sqr_variance = (double)sqr_difference / count;
 }
 
-void kuwahara_filter(const cv::Mat& src, cv::Mat& dst, int kernel_size) {
-    for (int c = 0; c < src.cols; ++c) {
-        for (int r = 0; r < src.rows; ++r) {
+/*
+ * Filter a band of rows.
+ * @param src Source image.
+ * @param dst Destination image.
+ * @param kernel_size Size of the kernel N, where the total size is 2*N+1.
+ * @param first_row First row of the band.
+ * @param last_row One past the last row of the band.
+ */
+static void kuwahara_filter_rows(const cv::Mat& src, cv::Mat& dst, int kernel_size, int first_row, int last_row) {
+    if (first_row >= last_row)
+        return;
+
+    // Column sums of the rows covered by the upper (r-N to r) and lower (r to r+N) quadrants, with padded columns.
+    const int padded_cols = src.cols + 2 * kernel_size;
+    std::vector<window_sums> upper_sums(padded_cols, window_sums());
+    std::vector<window_sums> lower_sums(padded_cols, window_sums());
+    std::vector<window_sums> upper_prefix_sums(padded_cols + 1, window_sums());
+    std::vector<window_sums> lower_prefix_sums(padded_cols + 1, window_sums());
+
+    for (int offset = 0; offset <= kernel_size; ++offset) {
+        add_row(src, first_row + offset - kernel_size, kernel_size, 1, upper_sums);
+        add_row(src, first_row + offset, kernel_size, 1, lower_sums);
+    }
+
+    for (int r = first_row; r < last_row; ++r) {
+        // Slide the windows down one row.
+        if (r > first_row) {
+            add_row(src, r - kernel_size - 1, kernel_size, -1, upper_sums);
+            add_row(src, r, kernel_size, 1, upper_sums);
+            add_row(src, r - 1, kernel_size, -1, lower_sums);
+            add_row(src, r + kernel_size, kernel_size, 1, lower_sums);
+        }
+
+        pad_columns(kernel_size, upper_sums);
+        pad_columns(kernel_size, lower_sums);
+        prefix_sum(upper_sums, upper_prefix_sums);
+        prefix_sum(lower_sums, lower_prefix_sums);
+
+        cv::Vec3b* dst_row = dst.ptr<cv::Vec3b>(r);
+        for (int c = 0; c < src.cols; ++c) {
+            // Quadrants in the same order as before: upper right, upper left, lower left, lower right.
+            // Pixel c is padded column c+N, so quadrants to the left start at padded column c and to the right at c+N.
+            const std::vector<window_sums>* quadrant_prefix_sums[4] = { &upper_prefix_sums, &upper_prefix_sums, &lower_prefix_sums, &lower_prefix_sums };
+            const int quadrant_columns[4] = { c + kernel_size, c, c, c + kernel_size };
+
             cv::Vec3i mean, in_mean;
             double in_sqr_variance;
             double sqr_variance = std::numeric_limits<double>::max();
             // Execute kuwahara kernel for each quadrant surrounding pixel.
-            for (int quadrant = 1; quadrant <= 4; ++quadrant) {
-                kuwahara_kernel(src, r, c, kernel_size, quadrant, in_mean, in_sqr_variance);
+            for (int quadrant = 0; quadrant < 4; ++quadrant) {
+                kuwahara_kernel(*quadrant_prefix_sums[quadrant], quadrant_columns[quadrant], kernel_size, in_mean, in_sqr_variance);
                 // Store mean with lowest variance.
                 if (in_sqr_variance < sqr_variance) {
                     sqr_variance = in_sqr_variance;
@@ -74,7 +155,14 @@ void kuwahara_filter(const cv::Mat& src, cv::Mat& dst, int kernel_size) {
                 }
             }
             // Set value to destination image.
-            dst.at<cv::Vec3b>(r, c) = mean;
+            dst_row[c] = mean;
         }
     }
 }
+
+void kuwahara_filter(const cv::Mat& src, cv::Mat& dst, int kernel_size, unsigned int thread_count) {
+    // Every band sets up its own running sums, so bands can be filtered independently.
+    ptgi_parallel_for(src.rows, thread_count, [&](unsigned int first_row, unsigned int last_row) {
+        kuwahara_filter_rows(src, dst, kernel_size, first_row, last_row);
+    });
+}
@@ -5,10 +5,12 @@
 
 /**
  * Non-linear smoothing filter.
+ * Quadrant statistics are calculated from running sums, so the cost per pixel doesn't depend on the kernel size.
  * @param src Source image.
  * @param dst Destination image.
  * @param kernel_size Size of the kernel N, where the total size is 2*N+1.
+ * @param thread_count Number of threads to filter bands of rows on. 0 or 1 filters the image on the calling thread.
  */
-void kuwahara_filter(const cv::Mat& src, cv::Mat& dst, int kernel_size);
+void kuwahara_filter(const cv::Mat& src, cv::Mat& dst, int kernel_size, unsigned int thread_count);
 
 #endif
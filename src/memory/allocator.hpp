@@ -0,0 +1,81 @@
+#ifndef ALLOCATOR_HPP
+#define ALLOCATOR_HPP
+
+#include <photogeo.h>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+/*
+ * Allocate an array using an allocator, or new[] if there is none.
+ * Elements are not constructed when using an allocator, so only use this for types that don't need construction.
+ * @param allocator The allocator to use, or nullptr.
+ * @param count The number of elements.
+ * @return The array.
+ */
+template<typename T>
+T* ptgi_allocate(const ptg_allocator* allocator, std::size_t count) {
+    if (allocator == nullptr)
+        return new T[count];
+
+    void* memory = allocator->alloc(sizeof(T) * count, allocator->user_data);
+    if (memory == nullptr && count > 0)
+        throw std::bad_alloc();
+    return static_cast<T*>(memory);
+}
+
+/*
+ * Free an array allocated with ptgi_allocate.
+ * @param allocator The allocator the array was allocated with, or nullptr.
+ * @param pointer The array.
+ */
+template<typename T>
+void ptgi_free(const ptg_allocator* allocator, T* pointer) {
+    if (allocator == nullptr)
+        delete[] pointer;
+    else if (pointer != nullptr)
+        allocator->free(pointer, allocator->user_data);
+}
+
+// Lets standard containers allocate using an allocator, or new[] if there is none.
+template<typename T>
+class container_allocator {
+    public:
+        typedef T value_type;
+        typedef std::true_type propagate_on_container_copy_assignment;
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type propagate_on_container_swap;
+
+        container_allocator(const ptg_allocator* allocator = nullptr) : allocator(allocator) {}
+
+        template<typename U>
+        container_allocator(const container_allocator<U>& other) : allocator(other.allocator) {}
+
+        T* allocate(std::size_t count) {
+            if (allocator == nullptr)
+                return static_cast<T*>(::operator new(sizeof(T) * count));
+            return ptgi_allocate<T>(allocator, count);
+        }
+
+        void deallocate(T* pointer, std::size_t) {
+            if (allocator == nullptr)
+                ::operator delete(pointer);
+            else
+                ptgi_free(allocator, pointer);
+        }
+
+        template<typename U>
+        bool operator==(const container_allocator<U>& other) const {
+            return allocator == other.allocator;
+        }
+
+        template<typename U>
+        bool operator!=(const container_allocator<U>& other) const {
+            return allocator != other.allocator;
+        }
+
+        // The allocator to use, or nullptr.
+        const ptg_allocator* allocator;
+};
+
+#endif
@@ -1,46 +1,35 @@
 #include <photogeo.h>
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include "image_processing/image_processing.hpp"
+#include "memory/allocator.hpp"
 #include "quantization/quantization.hpp"
+#include "quantization/quantization_lut.hpp"
+#include "threading/parallel_for.hpp"
 #include "tracing/marching_squares.hpp"
 #include "vertex_reduction/douglas_peucker.hpp"
 #include "vertex_reduction/visvalingam_whyatt.hpp"
 
-void ptg_generate_collision_geometry(const ptg_generation_parameters* parameters, ptg_outline*** out_outlines, unsigned int** out_outline_counts) {
-    // Image processing.
-    ptg_image_process(parameters->image_parameters, parameters->image_processing_parameters);
-
-    // Quantization.
-    ptg_quantization_results quantization_results;
-    ptg_quantize(parameters->image_parameters, parameters->quantization_parameters, &quantization_results);
-
-    // Tracing.
-    ptg_tracing_results tracing_results;
-    ptg_trace(parameters->image_parameters, &quantization_results, parameters->tracing_parameters, &tracing_results);
-
-    // Quantization results are no longer needed.
-    ptg_free_quantization_results(&quantization_results);
-
-    // Vertex reduction.
-    ptg_reduce(&tracing_results, parameters->vertex_reduction_parameters);
-
-    *out_outlines = tracing_results.outlines;
-    *out_outline_counts = tracing_results.outline_counts;
+void ptg_free_results(unsigned int layer_count, ptg_outline** outlines, unsigned int* outline_counts) {
+    ptg_free_results_with_allocator(nullptr, layer_count, outlines, outline_counts);
 }
 
-void ptg_free_results(unsigned int layer_count, ptg_outline** outlines, unsigned int* outline_counts) {
+void ptg_free_results_with_allocator(const ptg_allocator* allocator, unsigned int layer_count, ptg_outline** outlines, unsigned int* outline_counts) {
     for (unsigned int layer_index = 0; layer_index < layer_count; ++layer_index) {
         for (unsigned int outline_index = 0; outline_index < outline_counts[layer_index]; ++outline_index)
-            delete[] outlines[layer_index][outline_index].vertices;
-        delete[] outlines[layer_index];
+            ptgi_free(allocator, outlines[layer_index][outline_index].vertices);
+        ptgi_free(allocator, outlines[layer_index]);
     }
-    delete[] outlines;
-    delete[] outline_counts;
+    ptgi_free(allocator, outlines);
+    ptgi_free(allocator, outline_counts);
 }
 
 void ptg_image_process(const ptg_image_parameters* image_parameters, const ptg_image_processing_parameters* image_processing_parameters) {
-    ptgi_image_process(image_parameters, image_processing_parameters);
+    cv::Mat buffer;
+    ptgi_image_process(image_parameters, image_processing_parameters, buffer);
 }
 
 void ptg_quantize(const ptg_image_parameters* image_parameters, const ptg_quantization_parameters* quantization_parameters, ptg_quantization_results* quantization_results) {
@@ -50,7 +39,7 @@ void ptg_quantize(const ptg_image_parameters* image_parameters, const ptg_quanti
         quantization_results->layers[layer] = new bool[image_parameters->width * image_parameters->height];
 
     // Quantize image into layers.
-    quantize(image_parameters, quantization_results->layers, quantization_parameters->quantization_method);
+    quantize(image_parameters, quantization_results->layers, quantization_parameters);
 
     quantization_results->layer_count = image_parameters->color_layer_count;
 }
@@ -61,34 +50,471 @@ void ptg_free_quantization_results(ptg_quantization_results* quantization_result
     delete[] quantization_results->layers;
 }
 
-void ptg_trace(const ptg_image_parameters* image_parameters, const ptg_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_tracing_results* out_tracing_results) {
-    // Allocate outlines.
-    out_tracing_results->layer_count = quantization_results->layer_count;
-    out_tracing_results->outline_counts = new unsigned int[out_tracing_results->layer_count];
-    out_tracing_results->outlines = new ptg_outline*[out_tracing_results->layer_count];
+/*
+ * Allocate bit-packed layers for an image.
+ * @param image_parameters Source image parameters.
+ * @param allocator Allocator to allocate the layers with, or nullptr.
+ * @param out_quantization_results Variable to store the layers in.
+ */
+static void allocate_packed_quantization_results(const ptg_image_parameters* image_parameters, const ptg_allocator* allocator, ptg_packed_quantization_results* out_quantization_results) {
+    out_quantization_results->words_per_row = (image_parameters->width + 63) / 64;
+    out_quantization_results->layers = ptgi_allocate<unsigned long long*>(allocator, image_parameters->color_layer_count);
+    for (unsigned int layer = 0; layer < image_parameters->color_layer_count; ++layer)
+        out_quantization_results->layers[layer] = ptgi_allocate<unsigned long long>(allocator, out_quantization_results->words_per_row * image_parameters->height);
+    out_quantization_results->layer_count = image_parameters->color_layer_count;
+}
+
+/*
+ * Quantize image into bit-packed layers.
+ * @param image_parameters Source image parameters.
+ * @param quantization_parameters Quantization parameters.
+ * @param allocator Allocator to allocate the layers with, or nullptr.
+ * @param out_quantization_results Variable to store quantization results.
+ */
+static void quantize_packed(const ptg_image_parameters* image_parameters, const ptg_quantization_parameters* quantization_parameters, const ptg_allocator* allocator, ptg_packed_quantization_results* out_quantization_results) {
+    allocate_packed_quantization_results(image_parameters, allocator, out_quantization_results);
+
+    // Quantize image into layers.
+    quantize_packed(image_parameters, out_quantization_results->layers, out_quantization_results->words_per_row, quantization_parameters);
+}
+
+/*
+ * Free bit-packed quantization results.
+ * @param allocator Allocator the layers were allocated with, or nullptr.
+ * @param quantization_results Quantization results to free.
+ */
+static void free_packed_quantization_results(const ptg_allocator* allocator, ptg_packed_quantization_results* quantization_results) {
+    for (unsigned int layer = 0; layer < quantization_results->layer_count; ++layer)
+        ptgi_free(allocator, quantization_results->layers[layer]);
+    ptgi_free(allocator, quantization_results->layers);
+}
+
+void ptg_quantize_packed(const ptg_image_parameters* image_parameters, const ptg_quantization_parameters* quantization_parameters, ptg_packed_quantization_results* out_quantization_results) {
+    quantize_packed(image_parameters, quantization_parameters, nullptr, out_quantization_results);
+}
+
+void ptg_free_packed_quantization_results(ptg_packed_quantization_results* quantization_results) {
+    free_packed_quantization_results(nullptr, quantization_results);
+}
+
+void ptg_quantize_labels(const ptg_image_parameters* image_parameters, const ptg_quantization_parameters* quantization_parameters, ptg_label_quantization_results* out_quantization_results) {
+    // Allocate label image.
+    out_quantization_results->labels = new unsigned short[image_parameters->width * image_parameters->height];
+
+    // Quantize image into labels.
+    quantize_labels(image_parameters, out_quantization_results->labels, quantization_parameters);
+
+    out_quantization_results->layer_count = image_parameters->color_layer_count;
+}
+
+void ptg_free_label_quantization_results(ptg_label_quantization_results* quantization_results) {
+    delete[] quantization_results->labels;
+}
 
+void ptg_create_quantization_lut(const ptg_image_parameters* image_parameters, const ptg_quantization_parameters* quantization_parameters, unsigned int subsample_bits, ptg_quantization_lut* out_lut) {
+    ptgi_create_quantization_lut(image_parameters, quantization_parameters, subsample_bits, out_lut);
+}
+
+void ptg_free_quantization_lut(ptg_quantization_lut* lut) {
+    delete[] lut->entries;
+}
+
+void ptg_quantize_with_lut(const ptg_image_parameters* image_parameters, const ptg_quantization_lut* lut, ptg_quantization_results* out_quantization_results) {
+    // Allocate color layers.
+    out_quantization_results->layers = new bool*[lut->color_layer_count];
+    for (unsigned int layer = 0; layer < lut->color_layer_count; ++layer)
+        out_quantization_results->layers[layer] = new bool[image_parameters->width * image_parameters->height];
+
+    // Quantize image into layers.
+    ptgi_quantize_with_lut(image_parameters, lut, out_quantization_results->layers);
+
+    out_quantization_results->layer_count = lut->color_layer_count;
+}
+
+// Function tracing one layer with marching squares, given the layer index, the number of threads to trace its tiles on and where to store its outlines.
+typedef std::function<void(unsigned int, unsigned int, traced_layer&)> layer_tracer;
+
+/*
+ * Trace every layer.
+ * @param layer_count Number of layers.
+ * @param tracing_parameters Tracing parameters.
+ * @param trace_layer Function tracing one layer.
+ * @param allocator Allocator to allocate the traced layers with, or nullptr.
+ * @param reused_layers Traced layers to reuse the memory of, one per layer, or nullptr to allocate new ones.
+ * @param store_layer Function to call with the index and outlines of every traced layer.
+ */
+static void trace_layers(unsigned int layer_count, const ptg_tracing_parameters* tracing_parameters, const layer_tracer& trace_layer, const ptg_allocator* allocator, traced_layer* reused_layers, const std::function<void(unsigned int, traced_layer&)>& store_layer) {
     switch (tracing_parameters->tracing_method) {
-        case PTG_MARCHING_SQUARES:
-            // Trace image using marching squares.
-            for (unsigned int layer_index = 0; layer_index < out_tracing_results->layer_count; ++layer_index)
-                ptgi_trace_marching_squares(quantization_results->layers[layer_index], image_parameters->width, image_parameters->height, out_tracing_results->outlines[layer_index], out_tracing_results->outline_counts[layer_index]);
+        case PTG_MARCHING_SQUARES: {
+            // Trace image using marching squares. Layers are independent, so they can be traced concurrently unless their tiles are.
+            const bool tiled = tracing_parameters->tile_size > 0;
+            ptgi_parallel_for_each(layer_count, tiled ? 1 : tracing_parameters->thread_count, [&](unsigned int layer_index) {
+                if (reused_layers != nullptr) {
+                    traced_layer& layer = reused_layers[layer_index];
+                    layer.clear();
+                    trace_layer(layer_index, tiled ? tracing_parameters->thread_count : 1, layer);
+                    store_layer(layer_index, layer);
+                } else {
+                    traced_layer layer(allocator);
+                    trace_layer(layer_index, tiled ? tracing_parameters->thread_count : 1, layer);
+                    store_layer(layer_index, layer);
+                }
+            });
             break;
+        }
+    }
+}
+
+/*
+ * Copy the outlines of a traced layer, pointing them at vertices that have already been copied.
+ * @param layer The traced layer.
+ * @param vertices Where the layer's vertices have been copied to.
+ * @param out_outlines Array to store the outlines in.
+ */
+static void create_outlines(const traced_layer& layer, ptg_vec2* vertices, ptg_outline* out_outlines) {
+    for (unsigned int outline_index = 0; outline_index < layer.outline_count(); ++outline_index) {
+        ptg_outline& outline = out_outlines[outline_index];
+        outline.vertex_count = layer.vertex_offsets[outline_index + 1] - layer.vertex_offsets[outline_index];
+        outline.vertices = vertices + layer.vertex_offsets[outline_index];
+        outline.parent = layer.parents[outline_index];
+        outline.hole = layer.holes[outline_index];
+    }
+}
+
+/*
+ * Copy the outlines of a traced layer, allocating every outline's vertices separately.
+ * @param layer The traced layer.
+ * @param allocator Allocator to allocate the outlines with, or nullptr.
+ * @param out_outlines Variable to store resulting outlines.
+ * @param out_outline_count Variable to store number of resulting outlines.
+ */
+static void create_separate_outlines(const traced_layer& layer, const ptg_allocator* allocator, ptg_outline*& out_outlines, unsigned int& out_outline_count) {
+    out_outline_count = layer.outline_count();
+    out_outlines = ptgi_allocate<ptg_outline>(allocator, out_outline_count);
+    create_outlines(layer, nullptr, out_outlines);
+    for (unsigned int outline_index = 0; outline_index < out_outline_count; ++outline_index) {
+        ptg_outline& outline = out_outlines[outline_index];
+        outline.vertices = ptgi_allocate<ptg_vec2>(allocator, outline.vertex_count);
+        memcpy(outline.vertices, layer.vertices.data() + layer.vertex_offsets[outline_index], sizeof(ptg_vec2) * outline.vertex_count);
     }
 }
 
+/*
+ * Allocate tracing results and trace every layer.
+ * @param layer_count Number of layers.
+ * @param tracing_parameters Tracing parameters.
+ * @param trace_layer Function tracing one layer.
+ * @param allocator Allocator to allocate the results and the traced layers with, or nullptr.
+ * @param reused_layers Traced layers to reuse the memory of, one per layer, or nullptr to allocate new ones.
+ * @param out_tracing_results Variable to store tracing results.
+ */
+static void trace_layers(unsigned int layer_count, const ptg_tracing_parameters* tracing_parameters, const layer_tracer& trace_layer, const ptg_allocator* allocator, traced_layer* reused_layers, ptg_tracing_results* out_tracing_results) {
+    // Allocate outlines.
+    out_tracing_results->layer_count = layer_count;
+    out_tracing_results->outline_counts = ptgi_allocate<unsigned int>(allocator, out_tracing_results->layer_count);
+    out_tracing_results->outlines = ptgi_allocate<ptg_outline*>(allocator, out_tracing_results->layer_count);
+
+    trace_layers(layer_count, tracing_parameters, trace_layer, allocator, reused_layers, [out_tracing_results, allocator](unsigned int layer_index, traced_layer& layer) {
+        create_separate_outlines(layer, allocator, out_tracing_results->outlines[layer_index], out_tracing_results->outline_counts[layer_index]);
+    });
+}
+
+/*
+ * Trace every layer and store the outlines and vertices of all layers in single buffers.
+ * @param layer_count Number of layers.
+ * @param tracing_parameters Tracing parameters.
+ * @param trace_layer Function tracing one layer.
+ * @param allocator Allocator to allocate the results and the traced layers with, or nullptr.
+ * @param out_tracing_results Variable to store tracing results.
+ */
+static void trace_layers(unsigned int layer_count, const ptg_tracing_parameters* tracing_parameters, const layer_tracer& trace_layer, const ptg_allocator* allocator, ptg_contiguous_tracing_results* out_tracing_results) {
+    std::vector<traced_layer> layers(layer_count, traced_layer(allocator));
+    trace_layers(layer_count, tracing_parameters, trace_layer, allocator, nullptr, [&layers](unsigned int layer_index, traced_layer& layer) {
+        layers[layer_index] = std::move(layer);
+    });
+
+    // Allocate buffers once the total sizes are known.
+    unsigned int outline_count = 0;
+    std::size_t vertex_count = 0;
+    for (const traced_layer& layer : layers) {
+        outline_count += layer.outline_count();
+        vertex_count += layer.vertices.size();
+    }
+    out_tracing_results->layer_count = layer_count;
+    out_tracing_results->outline_counts = ptgi_allocate<unsigned int>(allocator, layer_count);
+    out_tracing_results->outline_offsets = ptgi_allocate<unsigned int>(allocator, layer_count);
+    out_tracing_results->outlines = ptgi_allocate<ptg_outline>(allocator, outline_count);
+    out_tracing_results->vertices = ptgi_allocate<ptg_vec2>(allocator, vertex_count);
+
+    // Copy layers.
+    unsigned int outline_offset = 0;
+    ptg_vec2* vertices = out_tracing_results->vertices;
+    for (unsigned int layer_index = 0; layer_index < layer_count; ++layer_index) {
+        traced_layer& layer = layers[layer_index];
+        memcpy(vertices, layer.vertices.data(), sizeof(ptg_vec2) * layer.vertices.size());
+        create_outlines(layer, vertices, out_tracing_results->outlines + outline_offset);
+
+        out_tracing_results->outline_counts[layer_index] = layer.outline_count();
+        out_tracing_results->outline_offsets[layer_index] = outline_offset;
+        outline_offset += layer.outline_count();
+        vertices += layer.vertices.size();
+        layer = traced_layer(allocator);
+    }
+}
+
+// Get a function tracing one layer of bool layers.
+static layer_tracer bool_layer_tracer(const ptg_image_parameters* image_parameters, const ptg_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters) {
+    return [=](unsigned int layer_index, unsigned int thread_count, traced_layer& out_layer) {
+        ptgi_trace_marching_squares(quantization_results->layers[layer_index], image_parameters->width, image_parameters->height, tracing_parameters->tile_size, thread_count, out_layer);
+    };
+}
+
+// Get a function tracing one layer of bit-packed layers.
+static layer_tracer packed_layer_tracer(const ptg_image_parameters* image_parameters, const ptg_packed_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters) {
+    return [=](unsigned int layer_index, unsigned int thread_count, traced_layer& out_layer) {
+        ptgi_trace_marching_squares_packed(quantization_results->layers[layer_index], quantization_results->words_per_row, image_parameters->width, image_parameters->height, tracing_parameters->tile_size, thread_count, out_layer);
+    };
+}
+
+// Get a function tracing one layer of a label image.
+static layer_tracer label_layer_tracer(const ptg_image_parameters* image_parameters, const ptg_label_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters) {
+    return [=](unsigned int layer_index, unsigned int thread_count, traced_layer& out_layer) {
+        ptgi_trace_marching_squares_labels(quantization_results->labels, (unsigned short)layer_index, image_parameters->width, image_parameters->height, tracing_parameters->tile_size, thread_count, out_layer);
+    };
+}
+
+void ptg_trace(const ptg_image_parameters* image_parameters, const ptg_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_tracing_results* out_tracing_results) {
+    trace_layers(quantization_results->layer_count, tracing_parameters, bool_layer_tracer(image_parameters, quantization_results, tracing_parameters), nullptr, nullptr, out_tracing_results);
+}
+
+void ptg_trace_packed(const ptg_image_parameters* image_parameters, const ptg_packed_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_tracing_results* out_tracing_results) {
+    trace_layers(quantization_results->layer_count, tracing_parameters, packed_layer_tracer(image_parameters, quantization_results, tracing_parameters), nullptr, nullptr, out_tracing_results);
+}
+
+void ptg_trace_labels(const ptg_image_parameters* image_parameters, const ptg_label_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_tracing_results* out_tracing_results) {
+    trace_layers(quantization_results->layer_count, tracing_parameters, label_layer_tracer(image_parameters, quantization_results, tracing_parameters), nullptr, nullptr, out_tracing_results);
+}
+
+void ptg_trace_contiguous(const ptg_image_parameters* image_parameters, const ptg_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_contiguous_tracing_results* out_tracing_results) {
+    trace_layers(quantization_results->layer_count, tracing_parameters, bool_layer_tracer(image_parameters, quantization_results, tracing_parameters), nullptr, out_tracing_results);
+}
+
+void ptg_trace_packed_contiguous(const ptg_image_parameters* image_parameters, const ptg_packed_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_contiguous_tracing_results* out_tracing_results) {
+    trace_layers(quantization_results->layer_count, tracing_parameters, packed_layer_tracer(image_parameters, quantization_results, tracing_parameters), nullptr, out_tracing_results);
+}
+
+void ptg_trace_labels_contiguous(const ptg_image_parameters* image_parameters, const ptg_label_quantization_results* quantization_results, const ptg_tracing_parameters* tracing_parameters, ptg_contiguous_tracing_results* out_tracing_results) {
+    trace_layers(quantization_results->layer_count, tracing_parameters, label_layer_tracer(image_parameters, quantization_results, tracing_parameters), nullptr, out_tracing_results);
+}
+
+ptg_trace_stream* ptg_trace_begin(unsigned int width) {
+    return ptgi_trace_stream_begin(width);
+}
+
+void ptg_trace_push_rows(ptg_trace_stream* stream, const bool* rows, unsigned int row_count) {
+    ptgi_trace_stream_push_rows(stream, rows, row_count);
+}
+
+void ptg_trace_end(ptg_trace_stream* stream, ptg_tracing_results* out_tracing_results) {
+    traced_layer layer;
+    ptgi_trace_stream_end(stream, layer);
+
+    out_tracing_results->layer_count = 1;
+    out_tracing_results->outline_counts = new unsigned int[1];
+    out_tracing_results->outlines = new ptg_outline*[1];
+    create_separate_outlines(layer, nullptr, out_tracing_results->outlines[0], out_tracing_results->outline_counts[0]);
+}
+
 void ptg_free_tracing_results(ptg_tracing_results* tracing_results) {
     ptg_free_results(tracing_results->layer_count, tracing_results->outlines, tracing_results->outline_counts);
 }
 
-void ptg_reduce(ptg_tracing_results* tracing_results, const ptg_vertex_reduction_parameters* vertex_reduction_parameters) {
+void ptg_free_contiguous_tracing_results(ptg_contiguous_tracing_results* tracing_results) {
+    delete[] tracing_results->outline_counts;
+    delete[] tracing_results->outline_offsets;
+    delete[] tracing_results->outlines;
+    delete[] tracing_results->vertices;
+}
+
+/*
+ * Reduce vertex count of the outlines of a layer.
+ * @param outlines The outlines.
+ * @param outline_count The number of outlines. Set to the number of remaining outlines.
+ * @param layer The index of the layer.
+ * @param vertex_reduction_parameters Vertex reduction parameters.
+ * @param scratch Scratch memory for each thread, from reserve_reduction_scratch.
+ * @param allocator Allocator to free removed outlines' vertices with, or nullptr.
+ * @param owns_vertices Whether every outline's vertices are allocated separately, so that removed outlines' vertices have to be freed.
+ */
+static void reduce_layer(ptg_outline* outlines, unsigned int& outline_count, unsigned int layer, const ptg_vertex_reduction_parameters* vertex_reduction_parameters, reduction_scratch* scratch, const ptg_allocator* allocator, bool owns_vertices) {
+    const float tolerance = vertex_reduction_parameters->layer_tolerances != nullptr ? vertex_reduction_parameters->layer_tolerances[layer] : vertex_reduction_parameters->tolerance;
+
     switch (vertex_reduction_parameters->vertex_reduction_method) {
         case PTG_NO_VERTEX_REDUCTION:
             break;
         case PTG_DOUGLAS_PEUCKER:
-            ptgi_douglas_peucker(tracing_results);
+            ptgi_douglas_peucker(outlines, outline_count, tolerance, vertex_reduction_parameters->thread_count, scratch, allocator, owns_vertices);
             break;
         case PTG_VISVALINGAM_WHYATT:
-            ptgi_visvalingam_whyatt(tracing_results);
+            ptgi_visvalingam_whyatt(outlines, outline_count, tolerance, vertex_reduction_parameters->thread_count, scratch, allocator, owns_vertices);
             break;
     }
+
+    // Reduce further to meet the vertex budget.
+    if (vertex_reduction_parameters->max_outline_vertex_count > 0 || vertex_reduction_parameters->max_layer_vertex_count > 0)
+        ptgi_reduce_to_vertex_budget(outlines, outline_count, vertex_reduction_parameters->max_outline_vertex_count, vertex_reduction_parameters->max_layer_vertex_count, scratch[0], allocator, owns_vertices);
+}
+
+/*
+ * Make sure there is scratch memory for every thread reducing vertices.
+ * @param scratch The scratch memory of the threads. Grown if too small.
+ * @param vertex_reduction_parameters Vertex reduction parameters.
+ * @param allocator Allocator to allocate new scratch memory with, or nullptr.
+ * @return The scratch memory of the threads.
+ */
+static reduction_scratch* reserve_reduction_scratch(std::vector<reduction_scratch>& scratch, const ptg_vertex_reduction_parameters* vertex_reduction_parameters, const ptg_allocator* allocator) {
+    const unsigned int thread_count = std::max(vertex_reduction_parameters->thread_count, 1u);
+    if (scratch.size() < thread_count)
+        scratch.resize(thread_count, reduction_scratch(allocator));
+    return scratch.data();
+}
+
+/*
+ * Reduce vertex count.
+ * @param tracing_results Tracing results.
+ * @param vertex_reduction_parameters Vertex reduction parameters.
+ * @param scratch Scratch memory for each thread, from reserve_reduction_scratch.
+ * @param allocator Allocator the results were allocated with, or nullptr.
+ */
+static void reduce(ptg_tracing_results* tracing_results, const ptg_vertex_reduction_parameters* vertex_reduction_parameters, reduction_scratch* scratch, const ptg_allocator* allocator) {
+    for (unsigned int layer = 0; layer < tracing_results->layer_count; ++layer)
+        reduce_layer(tracing_results->outlines[layer], tracing_results->outline_counts[layer], layer, vertex_reduction_parameters, scratch, allocator, true);
+}
+
+void ptg_reduce(ptg_tracing_results* tracing_results, const ptg_vertex_reduction_parameters* vertex_reduction_parameters) {
+    std::vector<reduction_scratch> scratch;
+    reduce(tracing_results, vertex_reduction_parameters, reserve_reduction_scratch(scratch, vertex_reduction_parameters, nullptr), nullptr);
+}
+
+void ptg_reduce_contiguous(ptg_contiguous_tracing_results* tracing_results, const ptg_vertex_reduction_parameters* vertex_reduction_parameters) {
+    std::vector<reduction_scratch> scratch;
+    reserve_reduction_scratch(scratch, vertex_reduction_parameters, nullptr);
+
+    // Vertices are reduced in place. Remaining outlines are moved down to close the gaps left by removed ones.
+    unsigned int outline_offset = 0;
+    for (unsigned int layer = 0; layer < tracing_results->layer_count; ++layer) {
+        ptg_outline* outlines = tracing_results->outlines + tracing_results->outline_offsets[layer];
+        reduce_layer(outlines, tracing_results->outline_counts[layer], layer, vertex_reduction_parameters, scratch.data(), nullptr, false);
+        memmove(tracing_results->outlines + outline_offset, outlines, sizeof(ptg_outline) * tracing_results->outline_counts[layer]);
+        tracing_results->outline_offsets[layer] = outline_offset;
+        outline_offset += tracing_results->outline_counts[layer];
+    }
+}
+
+// Scratch memory reused between generations.
+struct ptg_context {
+    // Image that filters write to.
+    cv::Mat image_buffer;
+
+    // Images that bands are filtered in when image processing and quantization are fused.
+    cv::Mat band_buffers[2];
+
+    // Bit-packed layers.
+    std::vector<std::vector<unsigned long long>> packed_layers;
+    std::vector<unsigned long long*> packed_layer_pointers;
+
+    // Traced layers, including the nodes used to trace them.
+    std::vector<traced_layer> traced_layers;
+
+    // Comparison colors, color cache and per-thread buffers of the quantization.
+    quantization_state quantization;
+
+    // Memory each thread uses while reducing vertices.
+    std::vector<reduction_scratch> vertex_reduction_scratch;
+};
+
+ptg_context* ptg_create_context() {
+    return new ptg_context();
+}
+
+void ptg_free_context(ptg_context* context) {
+    delete context;
+}
+
+void ptg_generate_collision_geometry(const ptg_generation_parameters* parameters, ptg_outline*** out_outlines, unsigned int** out_outline_counts) {
+    const ptg_allocator* allocator = parameters->allocator;
+    ptg_context* context = parameters->context;
+    const ptg_image_parameters* image_parameters = parameters->image_parameters;
+
+    // Allocate quantization results.
+    ptg_packed_quantization_results quantization_results;
+    traced_layer* reused_layers = nullptr;
+    if (context != nullptr) {
+        // Vectors only reallocate when growing, so frames of the same size reuse the memory.
+        const unsigned int layer_count = image_parameters->color_layer_count;
+        quantization_results.layer_count = layer_count;
+        quantization_results.words_per_row = (image_parameters->width + 63) / 64;
+        context->packed_layers.resize(std::max((std::size_t)layer_count, context->packed_layers.size()));
+        context->packed_layer_pointers.resize(context->packed_layers.size());
+        for (unsigned int layer = 0; layer < layer_count; ++layer) {
+            context->packed_layers[layer].resize(quantization_results.words_per_row * image_parameters->height);
+            context->packed_layer_pointers[layer] = context->packed_layers[layer].data();
+        }
+        quantization_results.layers = context->packed_layer_pointers.data();
+
+        if (context->traced_layers.size() < layer_count)
+            context->traced_layers.resize(layer_count);
+        reused_layers = context->traced_layers.data();
+    } else {
+        allocate_packed_quantization_results(image_parameters, allocator, &quantization_results);
+    }
+
+    // The comparison colors and color cache are set up once for the whole image, and shared by all bands when fusing image processing and quantization.
+    quantization_state local_quantization;
+    quantization_state& quantization = (context != nullptr) ? context->quantization : local_quantization;
+    setup_quantization(image_parameters, parameters->quantization_parameters, quantization);
+
+    if (parameters->fused_band_height > 0 && parameters->image_processing_parameters->method_count > 0) {
+        // Image processing and quantization, one band at a time.
+        cv::Mat local_band_buffers[2];
+        cv::Mat* band_buffers = (context != nullptr) ? context->band_buffers : local_band_buffers;
+        std::vector<unsigned long long*> band_layers(quantization_results.layer_count);
+
+        ptgi_image_process_bands(image_parameters, parameters->image_processing_parameters, parameters->fused_band_height, band_buffers, [&](unsigned int first_row, unsigned int row_count, const ptg_color* rows) {
+            // Quantize the band as an image of its own, writing to its rows of the layers.
+            ptg_image_parameters band_parameters = *image_parameters;
+            band_parameters.image = const_cast<ptg_color*>(rows);
+            band_parameters.height = row_count;
+            for (unsigned int layer = 0; layer < quantization_results.layer_count; ++layer)
+                band_layers[layer] = quantization_results.layers[layer] + first_row * quantization_results.words_per_row;
+            quantize_packed(quantization, &band_parameters, band_layers.data(), quantization_results.words_per_row, parameters->quantization_parameters);
+        });
+    } else {
+        // Image processing.
+        if (context != nullptr)
+            ptgi_image_process(image_parameters, parameters->image_processing_parameters, context->image_buffer);
+        else
+            ptg_image_process(image_parameters, parameters->image_processing_parameters);
+
+        // Quantization.
+        quantize_packed(quantization, image_parameters, quantization_results.layers, quantization_results.words_per_row, parameters->quantization_parameters);
+    }
+
+    // Tracing.
+    ptg_tracing_results tracing_results;
+    trace_layers(quantization_results.layer_count, parameters->tracing_parameters, packed_layer_tracer(parameters->image_parameters, &quantization_results, parameters->tracing_parameters), allocator, reused_layers, &tracing_results);
+
+    // Quantization results are no longer needed.
+    if (context == nullptr)
+        free_packed_quantization_results(allocator, &quantization_results);
+
+    // Vertex reduction.
+    std::vector<reduction_scratch> local_reduction_scratch;
+    if (context != nullptr)
+        reduce(&tracing_results, parameters->vertex_reduction_parameters, reserve_reduction_scratch(context->vertex_reduction_scratch, parameters->vertex_reduction_parameters, nullptr), allocator);
+    else
+        reduce(&tracing_results, parameters->vertex_reduction_parameters, reserve_reduction_scratch(local_reduction_scratch, parameters->vertex_reduction_parameters, allocator), allocator);
+
+    *out_outlines = tracing_results.outlines;
+    *out_outline_counts = tracing_results.outline_counts;
 }
@@ -1,6 +1,8 @@
 #include "color_conversion.hpp"
 
 #include <cmath>
+#include <cstring>
+#include "simd.hpp"
 
 cie_xyz rgb_to_xyz(const ptg_color& color) {
     cie_xyz result;
@@ -103,3 +105,109 @@ double srgb_to_linear(unsigned char component) {
     // Use lookup table for performance.
     return lookup_table[component];
 }
+
+// Same lookup table in single precision.
+static float lookup_table_float[256];
+
+// Fill lookup_table_float. Run once before the first fast conversion.
+static bool fill_lookup_table_float() {
+    for (unsigned int i = 0; i < 256; ++i)
+        lookup_table_float[i] = (float)lookup_table[i];
+
+    return true;
+}
+
+// XYZ matrix divided by the D65 white point (with normalization Y=1), so that each row directly gives the input to f.
+static const float x_r = (float)(0.4124 * 100.0 / 95.047), x_g = (float)(0.3576 * 100.0 / 95.047), x_b = (float)(0.1805 * 100.0 / 95.047);
+static const float y_r = 0.2126f, y_g = 0.7152f, y_b = 0.0722f;
+static const float z_r = (float)(0.0193 * 100.0 / 108.883), z_g = (float)(0.1192 * 100.0 / 108.883), z_b = (float)(0.9505 * 100.0 / 108.883);
+
+// Constants of f.
+static const float f_threshold = 0.008856f;
+static const float f_slope = 7.787f;
+static const float f_offset = 4.0f / 29.0f;
+
+// Added to a third of a float's bits to get a first guess of its cube root.
+static const int cbrt_magic = 709921077;
+
+/*
+ * Approximate f(t) for one value.
+ * The cube root is guessed by dividing the exponent by three through the float's bits, then refined by two Newton-Raphson iterations.
+ * Follows the exact steps of f_sse2, so both give the same results.
+ */
+static inline float f_fast(float t) {
+    if (!(t > f_threshold))
+        return t * f_slope + f_offset;
+
+    int bits;
+    memcpy(&bits, &t, sizeof(float));
+    bits = (int)((float)bits * (1.0f / 3.0f)) + cbrt_magic;
+    float y;
+    memcpy(&y, &bits, sizeof(float));
+
+    y = (y + y + t / (y * y)) * (1.0f / 3.0f);
+    y = (y + y + t / (y * y)) * (1.0f / 3.0f);
+    return y;
+}
+
+// Convert one color using f_fast.
+static inline void rgb_to_lab_fast_single(const ptg_color& color, float& out_l, float& out_a, float& out_b) {
+    const float r = lookup_table_float[color.r];
+    const float g = lookup_table_float[color.g];
+    const float b = lookup_table_float[color.b];
+
+    const float fx = f_fast(x_r * r + x_g * g + x_b * b);
+    const float fy = f_fast(y_r * r + y_g * g + y_b * b);
+    const float fz = f_fast(z_r * r + z_g * g + z_b * b);
+
+    out_l = 116.0f * fy - 16.0f;
+    out_a = 500.0f * (fx - fy);
+    out_b = 200.0f * (fy - fz);
+}
+
+#ifdef PTGI_SSE2
+// Approximate f(t) for four values. See f_fast.
+static inline __m128 f_sse2(__m128 t) {
+    const __m128 third = _mm_set1_ps(1.0f / 3.0f);
+
+    __m128i bits = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(t)), third));
+    __m128 y = _mm_castsi128_ps(_mm_add_epi32(bits, _mm_set1_epi32(cbrt_magic)));
+    y = _mm_mul_ps(_mm_add_ps(_mm_add_ps(y, y), _mm_div_ps(t, _mm_mul_ps(y, y))), third);
+    y = _mm_mul_ps(_mm_add_ps(_mm_add_ps(y, y), _mm_div_ps(t, _mm_mul_ps(y, y))), third);
+
+    const __m128 linear = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(f_slope)), _mm_set1_ps(f_offset));
+    const __m128 above = _mm_cmpgt_ps(t, _mm_set1_ps(f_threshold));
+    return _mm_or_ps(_mm_and_ps(above, y), _mm_andnot_ps(above, linear));
+}
+
+// Calculate one row of the XYZ matrix for four colors.
+static inline __m128 dot_sse2(__m128 r, __m128 g, __m128 b, float factor_r, float factor_g, float factor_b) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(factor_r), r), _mm_mul_ps(_mm_set1_ps(factor_g), g)), _mm_mul_ps(_mm_set1_ps(factor_b), b));
+}
+#endif
+
+void rgb_to_lab_fast(const ptg_color* colors, unsigned int color_count, float* out_l, float* out_a, float* out_b) {
+    static const bool filled = fill_lookup_table_float();
+    (void)filled;
+
+    unsigned int i = 0;
+#ifdef PTGI_SSE2
+    for (; i + 4 <= color_count; i += 4) {
+        const ptg_color* c = colors + i;
+        const __m128 r = _mm_setr_ps(lookup_table_float[c[0].r], lookup_table_float[c[1].r], lookup_table_float[c[2].r], lookup_table_float[c[3].r]);
+        const __m128 g = _mm_setr_ps(lookup_table_float[c[0].g], lookup_table_float[c[1].g], lookup_table_float[c[2].g], lookup_table_float[c[3].g]);
+        const __m128 b = _mm_setr_ps(lookup_table_float[c[0].b], lookup_table_float[c[1].b], lookup_table_float[c[2].b], lookup_table_float[c[3].b]);
+
+        const __m128 fx = f_sse2(dot_sse2(r, g, b, x_r, x_g, x_b));
+        const __m128 fy = f_sse2(dot_sse2(r, g, b, y_r, y_g, y_b));
+        const __m128 fz = f_sse2(dot_sse2(r, g, b, z_r, z_g, z_b));
+
+        _mm_storeu_ps(out_l + i, _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(116.0f), fy), _mm_set1_ps(16.0f)));
+        _mm_storeu_ps(out_a + i, _mm_mul_ps(_mm_set1_ps(500.0f), _mm_sub_ps(fx, fy)));
+        _mm_storeu_ps(out_b + i, _mm_mul_ps(_mm_set1_ps(200.0f), _mm_sub_ps(fy, fz)));
+    }
+#endif
+
+    for (; i < color_count; ++i)
+        rgb_to_lab_fast_single(colors[i], out_l[i], out_a[i], out_b[i]);
+}
@@ -33,6 +33,18 @@ cie_xyz rgb_to_xyz(const ptg_color& color);
  */
 cie_lab xyz_to_lab(const cie_xyz& color);
 
+/*
+ * Convert colors from RGB space to CIE L*a*b* space, several colors at a time.
+ * Uses D65 illuminant and single precision with an approximated cube root.
+ * Over all 24-bit colors, the results differ from xyz_to_lab(rgb_to_xyz(color)) by at most 0.0003 in L* and 0.0005 in a* and b*.
+ * @param colors The colors to convert.
+ * @param color_count The number of colors.
+ * @param out_l Array to store the lightness of each color in.
+ * @param out_a Array to store the green-red component of each color in.
+ * @param out_b Array to store the blue-yellow component of each color in.
+ */
+void rgb_to_lab_fast(const ptg_color* colors, unsigned int color_count, float* out_l, float* out_a, float* out_b);
+
 /*
  * Convert sRGB component to linear RGB.
  * @param component Component to convert (0-255).
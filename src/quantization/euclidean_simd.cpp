@@ -0,0 +1,200 @@
+#include "euclidean_simd.hpp"
+
+#include <limits>
+#include "color_conversion.hpp"
+#include "color_difference.hpp"
+#include "simd.hpp"
+
+// Compare colors one at a time.
+static void find_closest_scalar(const ptg_color* colors, unsigned int color_count, const ptg_color* comparison_colors, unsigned int comparison_color_count, bool linear, unsigned short* out_indices) {
+    double (*distance_function)(const ptg_color&, const ptg_color&) = linear ? color_distance_euclidean_linear_sqr : color_distance_euclidean_srgb_sqr;
+
+    for (unsigned int i = 0; i < color_count; ++i) {
+        unsigned int closest = 0;
+        double shortest = std::numeric_limits<double>::max();
+        for (unsigned int j = 0; j < comparison_color_count; ++j) {
+            double distance = distance_function(comparison_colors[j], colors[i]);
+            if (distance < shortest) {
+                shortest = distance;
+                closest = j;
+            }
+        }
+        out_indices[i] = (unsigned short)closest;
+    }
+}
+
+#ifdef PTGI_SSE2
+/*
+ * Compare four colors at a time in sRGB space.
+ * Red and green differences are interleaved in 16-bit lanes so that one multiply-add gives the sum of their squares in a 32-bit lane.
+ * Blue differences are paired with zero.
+ */
+static void find_closest_srgb_sse2(const ptg_color* colors, unsigned int color_count, const ptg_color* comparison_colors, unsigned int comparison_color_count, unsigned short* out_indices) {
+    unsigned int i = 0;
+    for (; i + 4 <= color_count; i += 4) {
+        const ptg_color* c = colors + i;
+        const __m128i rg = _mm_setr_epi16(c[0].r, c[0].g, c[1].r, c[1].g, c[2].r, c[2].g, c[3].r, c[3].g);
+        const __m128i b = _mm_setr_epi32(c[0].b, c[1].b, c[2].b, c[3].b);
+
+        __m128i shortest = _mm_set1_epi32(std::numeric_limits<int>::max());
+        __m128i closest = _mm_setzero_si128();
+        for (unsigned int j = 0; j < comparison_color_count; ++j) {
+            const __m128i difference_rg = _mm_sub_epi16(rg, _mm_set1_epi32(comparison_colors[j].r | (comparison_colors[j].g << 16)));
+            const __m128i difference_b = _mm_sub_epi16(b, _mm_set1_epi32(comparison_colors[j].b));
+            const __m128i distance = _mm_add_epi32(_mm_madd_epi16(difference_rg, difference_rg), _mm_madd_epi16(difference_b, difference_b));
+
+            // SSE2 has no blend, so select with masks.
+            const __m128i closer = _mm_cmplt_epi32(distance, shortest);
+            shortest = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, shortest));
+            closest = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(j)), _mm_andnot_si128(closer, closest));
+        }
+
+        int result[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(result), closest);
+        for (unsigned int k = 0; k < 4; ++k)
+            out_indices[i + k] = (unsigned short)result[k];
+    }
+
+    find_closest_scalar(colors + i, color_count - i, comparison_colors, comparison_color_count, false, out_indices + i);
+}
+
+// Compare two colors at a time in linear RGB space. Uses double precision so the results match the scalar path.
+static void find_closest_linear_sse2(const ptg_color* colors, unsigned int color_count, const ptg_color* comparison_colors, unsigned int comparison_color_count, unsigned short* out_indices) {
+    unsigned int i = 0;
+    for (; i + 2 <= color_count; i += 2) {
+        const ptg_color* c = colors + i;
+        const __m128d r = _mm_setr_pd(srgb_to_linear(c[0].r), srgb_to_linear(c[1].r));
+        const __m128d g = _mm_setr_pd(srgb_to_linear(c[0].g), srgb_to_linear(c[1].g));
+        const __m128d b = _mm_setr_pd(srgb_to_linear(c[0].b), srgb_to_linear(c[1].b));
+
+        __m128d shortest = _mm_set1_pd(std::numeric_limits<double>::max());
+        __m128d closest = _mm_setzero_pd();
+        for (unsigned int j = 0; j < comparison_color_count; ++j) {
+            const __m128d difference_r = _mm_sub_pd(r, _mm_set1_pd(srgb_to_linear(comparison_colors[j].r)));
+            const __m128d difference_g = _mm_sub_pd(g, _mm_set1_pd(srgb_to_linear(comparison_colors[j].g)));
+            const __m128d difference_b = _mm_sub_pd(b, _mm_set1_pd(srgb_to_linear(comparison_colors[j].b)));
+            __m128d distance = _mm_mul_pd(difference_r, difference_r);
+            distance = _mm_add_pd(distance, _mm_mul_pd(difference_g, difference_g));
+            distance = _mm_add_pd(distance, _mm_mul_pd(difference_b, difference_b));
+
+            const __m128d closer = _mm_cmplt_pd(distance, shortest);
+            shortest = _mm_or_pd(_mm_and_pd(closer, distance), _mm_andnot_pd(closer, shortest));
+            closest = _mm_or_pd(_mm_and_pd(closer, _mm_set1_pd(j)), _mm_andnot_pd(closer, closest));
+        }
+
+        double result[2];
+        _mm_storeu_pd(result, closest);
+        for (unsigned int k = 0; k < 2; ++k)
+            out_indices[i + k] = (unsigned short)result[k];
+    }
+
+    find_closest_scalar(colors + i, color_count - i, comparison_colors, comparison_color_count, true, out_indices + i);
+}
+#endif
+
+#ifdef PTGI_AVX2
+// Compare eight colors at a time in sRGB space. Same approach as find_closest_srgb_sse2.
+PTGI_TARGET_AVX2 static void find_closest_srgb_avx2(const ptg_color* colors, unsigned int color_count, const ptg_color* comparison_colors, unsigned int comparison_color_count, unsigned short* out_indices) {
+    unsigned int i = 0;
+    for (; i + 8 <= color_count; i += 8) {
+        const ptg_color* c = colors + i;
+        const __m256i rg = _mm256_setr_epi16(c[0].r, c[0].g, c[1].r, c[1].g, c[2].r, c[2].g, c[3].r, c[3].g,
+                                             c[4].r, c[4].g, c[5].r, c[5].g, c[6].r, c[6].g, c[7].r, c[7].g);
+        const __m256i b = _mm256_setr_epi32(c[0].b, c[1].b, c[2].b, c[3].b, c[4].b, c[5].b, c[6].b, c[7].b);
+
+        __m256i shortest = _mm256_set1_epi32(std::numeric_limits<int>::max());
+        __m256i closest = _mm256_setzero_si256();
+        for (unsigned int j = 0; j < comparison_color_count; ++j) {
+            const __m256i difference_rg = _mm256_sub_epi16(rg, _mm256_set1_epi32(comparison_colors[j].r | (comparison_colors[j].g << 16)));
+            const __m256i difference_b = _mm256_sub_epi16(b, _mm256_set1_epi32(comparison_colors[j].b));
+            const __m256i distance = _mm256_add_epi32(_mm256_madd_epi16(difference_rg, difference_rg), _mm256_madd_epi16(difference_b, difference_b));
+
+            const __m256i closer = _mm256_cmpgt_epi32(shortest, distance);
+            shortest = _mm256_blendv_epi8(shortest, distance, closer);
+            closest = _mm256_blendv_epi8(closest, _mm256_set1_epi32(j), closer);
+        }
+
+        int result[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(result), closest);
+        for (unsigned int k = 0; k < 8; ++k)
+            out_indices[i + k] = (unsigned short)result[k];
+    }
+
+    find_closest_srgb_sse2(colors + i, color_count - i, comparison_colors, comparison_color_count, out_indices + i);
+}
+
+// Compare four colors at a time in linear RGB space. Same approach as find_closest_linear_sse2.
+PTGI_TARGET_AVX2 static void find_closest_linear_avx2(const ptg_color* colors, unsigned int color_count, const ptg_color* comparison_colors, unsigned int comparison_color_count, unsigned short* out_indices) {
+    unsigned int i = 0;
+    for (; i + 4 <= color_count; i += 4) {
+        const ptg_color* c = colors + i;
+        const __m256d r = _mm256_setr_pd(srgb_to_linear(c[0].r), srgb_to_linear(c[1].r), srgb_to_linear(c[2].r), srgb_to_linear(c[3].r));
+        const __m256d g = _mm256_setr_pd(srgb_to_linear(c[0].g), srgb_to_linear(c[1].g), srgb_to_linear(c[2].g), srgb_to_linear(c[3].g));
+        const __m256d b = _mm256_setr_pd(srgb_to_linear(c[0].b), srgb_to_linear(c[1].b), srgb_to_linear(c[2].b), srgb_to_linear(c[3].b));
+
+        __m256d shortest = _mm256_set1_pd(std::numeric_limits<double>::max());
+        __m256d closest = _mm256_setzero_pd();
+        for (unsigned int j = 0; j < comparison_color_count; ++j) {
+            const __m256d difference_r = _mm256_sub_pd(r, _mm256_set1_pd(srgb_to_linear(comparison_colors[j].r)));
+            const __m256d difference_g = _mm256_sub_pd(g, _mm256_set1_pd(srgb_to_linear(comparison_colors[j].g)));
+            const __m256d difference_b = _mm256_sub_pd(b, _mm256_set1_pd(srgb_to_linear(comparison_colors[j].b)));
+            __m256d distance = _mm256_mul_pd(difference_r, difference_r);
+            distance = _mm256_add_pd(distance, _mm256_mul_pd(difference_g, difference_g));
+            distance = _mm256_add_pd(distance, _mm256_mul_pd(difference_b, difference_b));
+
+            const __m256d closer = _mm256_cmp_pd(distance, shortest, _CMP_LT_OQ);
+            shortest = _mm256_blendv_pd(shortest, distance, closer);
+            closest = _mm256_blendv_pd(closest, _mm256_set1_pd(j), closer);
+        }
+
+        double result[4];
+        _mm256_storeu_pd(result, closest);
+        for (unsigned int k = 0; k < 4; ++k)
+            out_indices[i + k] = (unsigned short)result[k];
+    }
+
+    find_closest_linear_sse2(colors + i, color_count - i, comparison_colors, comparison_color_count, out_indices + i);
+}
+
+// Check whether the CPU and operating system support AVX2.
+static bool supports_avx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // The operating system has to save the AVX registers.
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+void find_closest_colors_euclidean(const ptg_color* colors, unsigned int color_count, const ptg_color* comparison_colors, unsigned int comparison_color_count, bool linear, unsigned short* out_indices) {
+#ifdef PTGI_AVX2
+    static const bool avx2 = supports_avx2();
+    if (avx2) {
+        if (linear)
+            find_closest_linear_avx2(colors, color_count, comparison_colors, comparison_color_count, out_indices);
+        else
+            find_closest_srgb_avx2(colors, color_count, comparison_colors, comparison_color_count, out_indices);
+        return;
+    }
+#endif
+
+#ifdef PTGI_SSE2
+    if (linear)
+        find_closest_linear_sse2(colors, color_count, comparison_colors, comparison_color_count, out_indices);
+    else
+        find_closest_srgb_sse2(colors, color_count, comparison_colors, comparison_color_count, out_indices);
+#else
+    find_closest_scalar(colors, color_count, comparison_colors, comparison_color_count, linear, out_indices);
+#endif
+}
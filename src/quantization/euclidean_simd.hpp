@@ -0,0 +1,19 @@
+#ifndef EUCLIDEAN_SIMD_HPP
+#define EUCLIDEAN_SIMD_HPP
+
+#include <photogeo.h>
+
+/*
+ * Find the closest comparison color of a list of colors using squared euclidean distance.
+ * Several colors are compared at a time using AVX2 or SSE2 when the CPU supports it, falling back to scalar code otherwise.
+ * The results are identical to comparing each color with color_distance_euclidean_srgb_sqr or color_distance_euclidean_linear_sqr.
+ * @param colors The colors to find the closest comparison color of.
+ * @param color_count The number of colors.
+ * @param comparison_colors The colors to compare against.
+ * @param comparison_color_count The number of comparison colors.
+ * @param linear Whether to compare the colors in linear RGB space instead of sRGB space.
+ * @param out_indices Array to store the index of each color's closest comparison color in.
+ */
+void find_closest_colors_euclidean(const ptg_color* colors, unsigned int color_count, const ptg_color* comparison_colors, unsigned int comparison_color_count, bool linear, unsigned short* out_indices);
+
+#endif
@@ -1,8 +1,12 @@
 #include "quantization.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <limits>
 #include "color_conversion.hpp"
 #include "color_difference.hpp"
+#include "euclidean_simd.hpp"
+#include "../threading/parallel_for.hpp"
 
 // Convert from one color space to another.
 template<typename color_type>
@@ -18,71 +22,354 @@ inline cie_lab convert<cie_lab>(const ptg_color& color) {
     return xyz_to_lab(rgb_to_xyz(color));
 }
 
+/*
+ * Get the colors each pixel should be compared against (background colors followed by the color layer colors).
+ * @param parameters Image input parameters.
+ * @param out_count Variable to store the number of comparison colors.
+ * @return The comparison colors converted to the color space the comparison is performed in. Free with delete[].
+ */
 template<typename color_type>
-static void quantize_helper(const ptg_image_parameters* parameters, bool** layers, double (*distance_function)(const color_type&, const color_type&)) {
-    // Get colors each pixel should be compared against (foreground and background colors).
-    const unsigned int comparison_color_count = parameters->background_color_count + parameters->color_layer_count;
-    ptg_color* comparison_colors = new ptg_color[comparison_color_count];
-    for (unsigned int i = 0; i < comparison_color_count; ++i) {
+static color_type* convert_comparison_colors(const ptg_image_parameters* parameters, unsigned int& out_count) {
+    out_count = parameters->background_color_count + parameters->color_layer_count;
+    color_type* comparison_colors_conv = new color_type[out_count];
+    for (unsigned int i = 0; i < out_count; ++i) {
         if (i < parameters->background_color_count)
-            comparison_colors[i] = parameters->background_colors[i];
+            comparison_colors_conv[i] = convert<color_type>(parameters->background_colors[i]);
         else
-            comparison_colors[i] = parameters->color_layer_colors[i - parameters->background_color_count];
+            comparison_colors_conv[i] = convert<color_type>(parameters->color_layer_colors[i - parameters->background_color_count]);
     }
 
-    // Convert comparison colors to the color space the comparison is performed in.
-    color_type* comparison_colors_conv = new color_type[comparison_color_count];
+    return comparison_colors_conv;
+}
+
+/*
+ * Find the comparison color closest to a color that is already converted to the color space the comparison is performed in.
+ * @param comparison_colors_conv The comparison colors in the color space the comparison is performed in.
+ * @param comparison_color_count The number of comparison colors.
+ * @param color_conv The color to find the closest comparison color for.
+ * @param distance_function Function calculating the distance between two colors.
+ * @return The index of the closest comparison color.
+ */
+template<typename color_type>
+static unsigned int find_closest_converted_color(const color_type* comparison_colors_conv, unsigned int comparison_color_count, const color_type& color_conv, double (*distance_function)(const color_type&, const color_type&)) {
+    unsigned int closest = 0;
+    double shortest = std::numeric_limits<double>::max();
     for (unsigned int i = 0; i < comparison_color_count; ++i) {
-        comparison_colors_conv[i] = convert<color_type>(comparison_colors[i]);
+        // Calculate distance.
+        double distance = distance_function(comparison_colors_conv[i], color_conv);
+        if (distance < shortest) {
+            shortest = distance;
+            closest = i;
+        }
     }
 
-    // Loop through all pixels in image.
-    for (unsigned int y = 0; y < parameters->height; ++y) {
-        for (unsigned int x = 0; x < parameters->width; ++x) {
-            ptg_color color = parameters->image[y * parameters->width + x];
-
-            // Convert color to color space the comparison is performed in.
-            color_type color_conv = convert<color_type>(color);
-
-            // Find closest color.
-            unsigned int layer = 0;
-            double shortest = std::numeric_limits<double>::max();
-            for (unsigned int i = 0; i < comparison_color_count; ++i) {
-                // Calculate distance.
-                double distance = distance_function(comparison_colors_conv[i], color_conv);
-                if (distance < shortest) {
-                    shortest = distance;
-                    layer = i;
+    return closest;
+}
+
+/*
+ * Find the comparison color closest to a color.
+ * @param comparison_colors_conv The comparison colors in the color space the comparison is performed in.
+ * @param comparison_color_count The number of comparison colors.
+ * @param color The color to find the closest comparison color for.
+ * @param distance_function Function calculating the distance between two colors.
+ * @return The index of the closest comparison color.
+ */
+template<typename color_type>
+static unsigned int find_closest_color(const color_type* comparison_colors_conv, unsigned int comparison_color_count, const ptg_color& color, double (*distance_function)(const color_type&, const color_type&)) {
+    // Convert color to color space the comparison is performed in.
+    return find_closest_converted_color(comparison_colors_conv, comparison_color_count, convert<color_type>(color), distance_function);
+}
+
+// Check whether two colors are equal.
+static bool color_equal(const ptg_color& a, const ptg_color& b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+// Value in the color cache table marking a color whose closest comparison color hasn't been found yet.
+static const unsigned short uncached = std::numeric_limits<unsigned short>::max();
+
+// Number of pixels from which the color cache is stored in a table covering every 24-bit color instead of hash maps.
+static const unsigned int cache_table_pixel_count = 1 << 20;
+
+// Number of entries in the color cache table.
+static const unsigned int cache_table_size = 1 << 24;
+
+// Get the 24-bit key of a color in the color cache.
+static inline unsigned int cache_key(const ptg_color& color) {
+    return (color.r << 16) | (color.g << 8) | color.b;
+}
+
+/*
+ * Split the rows of an image into one band per thread and process the bands on separate threads, each with its own scratch memory.
+ * @param state Quantization state holding the scratch memory of each thread.
+ * @param parameters Image input parameters.
+ * @param function Function to call for each band with the thread's scratch memory, the first row and one past the last row.
+ */
+static void for_each_chunk(quantization_state& state, const ptg_image_parameters* parameters, const std::function<void(quantization_chunk&, unsigned int, unsigned int)>& function) {
+    const unsigned int chunk_count = std::min((unsigned int)state.chunks.size(), parameters->height);
+    ptgi_parallel_for(chunk_count, chunk_count, [&](unsigned int first_chunk, unsigned int last_chunk) {
+        for (unsigned int c = first_chunk; c < last_chunk; ++c) {
+            quantization_chunk& chunk = state.chunks[c];
+            chunk.closest.resize(parameters->width);
+            const unsigned int first_row = (unsigned int)((unsigned long long)parameters->height * c / chunk_count);
+            const unsigned int last_row = (unsigned int)((unsigned long long)parameters->height * (c + 1) / chunk_count);
+            function(chunk, first_row, last_row);
+        }
+    });
+}
+
+template<typename color_type>
+static void quantize_helper(quantization_state& state, const color_type* comparison_colors_conv, const ptg_image_parameters* parameters, double (*distance_function)(const color_type&, const color_type&), const row_writer& write_row) {
+    const unsigned int comparison_color_count = (unsigned int)state.comparison_colors.size();
+
+    // Find the index of the comparison color closest to a color.
+    auto find_closest = [&](const ptg_color& color) {
+        return find_closest_color(comparison_colors_conv, comparison_color_count, color, distance_function);
+    };
+
+    // The color cache table is shared between all threads.
+    // Racing threads can only ever store the same result for a color, so relaxed atomics are enough.
+    std::atomic<unsigned short>* cache_table = state.cache_table.empty() ? nullptr : state.cache_table.data();
+
+    // Loop through all pixels in image. Rows are split into bands which are quantized independently.
+    for_each_chunk(state, parameters, [&](quantization_chunk& chunk, unsigned int first_row, unsigned int last_row) {
+        // Key of the previous pixel's color. Neighboring pixels often share color, in which case no lookup is needed.
+        unsigned int previous_key = cache_table_size;
+
+        unsigned int layer = 0;
+        for (unsigned int y = first_row; y < last_row; ++y) {
+            for (unsigned int x = 0; x < parameters->width; ++x) {
+                ptg_color color = parameters->image[y * parameters->width + x];
+
+                // Find closest color, either directly or through the color cache.
+                if (!state.cache_colors) {
+                    layer = find_closest(color);
+                } else {
+                    const unsigned int key = cache_key(color);
+                    if (key != previous_key) {
+                        previous_key = key;
+                        if (cache_table != nullptr) {
+                            unsigned short cached = cache_table[key].load(std::memory_order_relaxed);
+                            if (cached == uncached) {
+                                cached = (unsigned short)find_closest(color);
+                                cache_table[key].store(cached, std::memory_order_relaxed);
+                            }
+                            layer = cached;
+                        } else {
+                            auto cached = chunk.cache_map.find(key);
+                            if (cached == chunk.cache_map.end())
+                                cached = chunk.cache_map.emplace(key, find_closest(color)).first;
+                            layer = cached->second;
+                        }
+                    }
                 }
+
+                chunk.closest[x] = (unsigned short)layer;
             }
 
             // Write color layers.
-            for (unsigned int i = 0; i < parameters->color_layer_count; ++i)
-                layers[i][y * parameters->width + x] = (i == layer - parameters->background_color_count);
+            write_row(y, chunk.closest.data());
         }
-    }
+    });
+}
+
+// Quantize image using euclidean distance, comparing several pixels at a time.
+static void quantize_euclidean(quantization_state& state, const ptg_image_parameters* parameters, bool linear, const row_writer& write_row) {
+    const unsigned int comparison_color_count = (unsigned int)state.comparison_colors.size();
+
+    // Loop through all rows in image. Rows are split into bands which are quantized independently.
+    for_each_chunk(state, parameters, [&](quantization_chunk& chunk, unsigned int first_row, unsigned int last_row) {
+        for (unsigned int y = first_row; y < last_row; ++y) {
+            // Find closest colors of the whole row.
+            find_closest_colors_euclidean(parameters->image + y * parameters->width, parameters->width, state.comparison_colors.data(), comparison_color_count, linear, chunk.closest.data());
+
+            // Write color layers.
+            write_row(y, chunk.closest.data());
+        }
+    });
+}
+
+template<typename color_type>
+static void find_closest_colors_helper(const ptg_image_parameters* parameters, const ptg_color* colors, unsigned int color_count, unsigned int thread_count, unsigned short* out_indices, double (*distance_function)(const color_type&, const color_type&)) {
+    // Get colors each color should be compared against.
+    unsigned int comparison_color_count;
+    color_type* comparison_colors_conv = convert_comparison_colors<color_type>(parameters, comparison_color_count);
+
+    ptgi_parallel_for(color_count, thread_count, [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; ++i)
+            out_indices[i] = (unsigned short)find_closest_color(comparison_colors_conv, comparison_color_count, colors[i], distance_function);
+    });
 
     // Cleanup.
-    delete[] comparison_colors;
     delete[] comparison_colors_conv;
 }
 
-void quantize(const ptg_image_parameters* parameters, bool** layers, ptg_quantization_method quantization_method) {
+// Quantize image in CIE L*a*b* space, converting a row of pixels at a time with rgb_to_lab_fast.
+static void quantize_lab_fast(quantization_state& state, const ptg_image_parameters* parameters, double (*distance_function)(const cie_lab&, const cie_lab&), const row_writer& write_row) {
+    const unsigned int comparison_color_count = (unsigned int)state.comparison_colors_lab.size();
+
+    // Loop through all rows in image. Rows are split into bands which are quantized independently.
+    for_each_chunk(state, parameters, [&](quantization_chunk& chunk, unsigned int first_row, unsigned int last_row) {
+        chunk.l.resize(parameters->width);
+        chunk.a.resize(parameters->width);
+        chunk.b.resize(parameters->width);
+        for (unsigned int y = first_row; y < last_row; ++y) {
+            // Convert the whole row.
+            rgb_to_lab_fast(parameters->image + y * parameters->width, parameters->width, chunk.l.data(), chunk.a.data(), chunk.b.data());
+
+            for (unsigned int x = 0; x < parameters->width; ++x) {
+                const cie_lab color_conv = { chunk.l[x], chunk.a[x], chunk.b[x] };
+                chunk.closest[x] = (unsigned short)find_closest_converted_color(state.comparison_colors_lab.data(), comparison_color_count, color_conv, distance_function);
+            }
+
+            // Write color layers.
+            write_row(y, chunk.closest.data());
+        }
+    });
+}
+
+// Quantize image in CIE L*a*b* space, using fast color conversion if requested.
+static void quantize_lab(quantization_state& state, const ptg_image_parameters* parameters, const ptg_quantization_parameters* quantization_parameters, double (*distance_function)(const cie_lab&, const cie_lab&), const row_writer& write_row) {
+    if (quantization_parameters->fast_color_conversion && !quantization_parameters->cache_colors)
+        quantize_lab_fast(state, parameters, distance_function, write_row);
+    else
+        quantize_helper<cie_lab>(state, state.comparison_colors_lab.data(), parameters, distance_function, write_row);
+}
+
+static void find_closest_colors_euclidean_helper(const ptg_image_parameters* parameters, const ptg_color* colors, unsigned int color_count, unsigned int thread_count, bool linear, unsigned short* out_indices) {
+    // Get colors each color should be compared against.
+    unsigned int comparison_color_count;
+    ptg_color* comparison_colors = convert_comparison_colors<ptg_color>(parameters, comparison_color_count);
+
+    ptgi_parallel_for(color_count, thread_count, [&](unsigned int first, unsigned int last) {
+        find_closest_colors_euclidean(colors + first, last - first, comparison_colors, comparison_color_count, linear, out_indices + first);
+    });
+
+    // Cleanup.
+    delete[] comparison_colors;
+}
+
+void setup_quantization(const ptg_image_parameters* parameters, const ptg_quantization_parameters* quantization_parameters, quantization_state& out_state) {
+    // Get colors each pixel should be compared against.
+    const unsigned int comparison_color_count = parameters->background_color_count + parameters->color_layer_count;
+    std::vector<ptg_color>& comparison_colors = out_state.comparison_colors;
+    const bool same_colors = comparison_colors.size() == comparison_color_count
+        && std::equal(parameters->background_colors, parameters->background_colors + parameters->background_color_count, comparison_colors.begin(), color_equal)
+        && std::equal(parameters->color_layer_colors, parameters->color_layer_colors + parameters->color_layer_count, comparison_colors.begin() + parameters->background_color_count, color_equal);
+    comparison_colors.resize(comparison_color_count);
+    std::copy(parameters->background_colors, parameters->background_colors + parameters->background_color_count, comparison_colors.begin());
+    std::copy(parameters->color_layer_colors, parameters->color_layer_colors + parameters->color_layer_count, comparison_colors.begin() + parameters->background_color_count);
+
+    const ptg_quantization_method quantization_method = quantization_parameters->quantization_method;
+    const bool lab = quantization_method != PTG_EUCLIDEAN_SRGB && quantization_method != PTG_EUCLIDEAN_LINEAR;
+    out_state.comparison_colors_lab.resize(lab ? comparison_color_count : 0);
+    for (unsigned int i = 0; i < out_state.comparison_colors_lab.size(); ++i)
+        out_state.comparison_colors_lab[i] = convert<cie_lab>(comparison_colors[i]);
+
+    // Cached colors are only valid for the colors and method they were found with.
+    const bool cache_valid = same_colors && out_state.quantization_method == quantization_method;
+    out_state.quantization_method = quantization_method;
+
+    // Only the CIE methods without fast color conversion cache colors.
+    out_state.cache_colors = quantization_parameters->cache_colors && lab && comparison_color_count < uncached;
+    if (out_state.cache_colors) {
+        // Store the color cache in a table for large images.
+        // The table is kept once allocated, since it is never slower than the hash maps.
+        const bool allocate_table = out_state.cache_table.empty() && (unsigned long long)parameters->width * parameters->height >= cache_table_pixel_count;
+        if (allocate_table)
+            std::vector<std::atomic<unsigned short>>(cache_table_size).swap(out_state.cache_table);
+        if (allocate_table || !cache_valid) {
+            for (std::atomic<unsigned short>& cached : out_state.cache_table)
+                cached.store(uncached, std::memory_order_relaxed);
+        }
+    }
+
+    out_state.chunks.resize(std::max(quantization_parameters->thread_count, 1u));
+    if (!cache_valid) {
+        for (quantization_chunk& chunk : out_state.chunks)
+            chunk.cache_map.clear();
+    }
+}
+
+void quantize_rows(quantization_state& state, const ptg_image_parameters* parameters, const ptg_quantization_parameters* quantization_parameters, const row_writer& write_row) {
+    switch (quantization_parameters->quantization_method) {
+        case PTG_EUCLIDEAN_SRGB:
+            quantize_euclidean(state, parameters, false, write_row);
+            break;
+        case PTG_EUCLIDEAN_LINEAR:
+            quantize_euclidean(state, parameters, true, write_row);
+            break;
+        case PTG_CIE76:
+            quantize_lab(state, parameters, quantization_parameters, color_distance_cie76_sqr, write_row);
+            break;
+        case PTG_CIE94:
+            quantize_lab(state, parameters, quantization_parameters, color_distance_cie94_sqr, write_row);
+            break;
+        case PTG_CIEDE2000:
+            quantize_lab(state, parameters, quantization_parameters, color_distance_ciede2000_sqr, write_row);
+            break;
+    }
+}
+
+void quantize_rows(const ptg_image_parameters* parameters, const ptg_quantization_parameters* quantization_parameters, const row_writer& write_row) {
+    quantization_state state;
+    setup_quantization(parameters, quantization_parameters, state);
+    quantize_rows(state, parameters, quantization_parameters, write_row);
+}
+
+void quantize(const ptg_image_parameters* parameters, bool** layers, const ptg_quantization_parameters* quantization_parameters) {
+    quantize_rows(parameters, quantization_parameters, [&](unsigned int y, const unsigned short* closest) {
+        for (unsigned int x = 0; x < parameters->width; ++x) {
+            const unsigned int layer = closest[x];
+            for (unsigned int i = 0; i < parameters->color_layer_count; ++i)
+                layers[i][y * parameters->width + x] = (i == layer - parameters->background_color_count);
+        }
+    });
+}
+
+void quantize_packed(const ptg_image_parameters* parameters, unsigned long long** layers, unsigned int words_per_row, const ptg_quantization_parameters* quantization_parameters) {
+    quantization_state state;
+    setup_quantization(parameters, quantization_parameters, state);
+    quantize_packed(state, parameters, layers, words_per_row, quantization_parameters);
+}
+
+void quantize_packed(quantization_state& state, const ptg_image_parameters* parameters, unsigned long long** layers, unsigned int words_per_row, const ptg_quantization_parameters* quantization_parameters) {
+    quantize_rows(state, parameters, quantization_parameters, [&](unsigned int y, const unsigned short* closest) {
+        // Rows start on a new word, so threads never write to the same word.
+        for (unsigned int i = 0; i < parameters->color_layer_count; ++i)
+            memset(layers[i] + y * words_per_row, 0, words_per_row * sizeof(unsigned long long));
+
+        for (unsigned int x = 0; x < parameters->width; ++x) {
+            const unsigned int layer = closest[x] - parameters->background_color_count;
+            if (layer < parameters->color_layer_count)
+                layers[layer][y * words_per_row + x / 64] |= 1ull << (x % 64);
+        }
+    });
+}
+
+void quantize_labels(const ptg_image_parameters* parameters, unsigned short* labels, const ptg_quantization_parameters* quantization_parameters) {
+    quantize_rows(parameters, quantization_parameters, [&](unsigned int y, const unsigned short* closest) {
+        for (unsigned int x = 0; x < parameters->width; ++x)
+            labels[y * parameters->width + x] = (closest[x] < parameters->background_color_count) ? parameters->color_layer_count : closest[x] - parameters->background_color_count;
+    });
+}
+
+void find_closest_colors(const ptg_image_parameters* parameters, const ptg_color* colors, unsigned int color_count, ptg_quantization_method quantization_method, unsigned int thread_count, unsigned short* out_indices) {
     switch (quantization_method) {
         case PTG_EUCLIDEAN_SRGB:
-            quantize_helper<ptg_color>(parameters, layers, color_distance_euclidean_srgb_sqr);
+            find_closest_colors_euclidean_helper(parameters, colors, color_count, thread_count, false, out_indices);
             break;
         case PTG_EUCLIDEAN_LINEAR:
-            quantize_helper<ptg_color>(parameters, layers, color_distance_euclidean_linear_sqr);
+            find_closest_colors_euclidean_helper(parameters, colors, color_count, thread_count, true, out_indices);
             break;
         case PTG_CIE76:
-            quantize_helper<cie_lab>(parameters, layers, color_distance_cie76_sqr);
+            find_closest_colors_helper<cie_lab>(parameters, colors, color_count, thread_count, out_indices, color_distance_cie76_sqr);
             break;
         case PTG_CIE94:
-            quantize_helper<cie_lab>(parameters, layers, color_distance_cie94_sqr);
+            find_closest_colors_helper<cie_lab>(parameters, colors, color_count, thread_count, out_indices, color_distance_cie94_sqr);
             break;
         case PTG_CIEDE2000:
-            quantize_helper<cie_lab>(parameters, layers, color_distance_ciede2000_sqr);
+            find_closest_colors_helper<cie_lab>(parameters, colors, color_count, thread_count, out_indices, color_distance_ciede2000_sqr);
             break;
     }
 }
@@ -2,13 +2,131 @@
 #define QUANTIZATION_HPP
 
 #include <photogeo.h>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "color_conversion.hpp"
+
+/*
+ * Function receiving quantized rows.
+ * Called with the y-coordinate of the row and the index of the closest comparison color of each pixel in it.
+ * Background colors come first, followed by the color layer colors.
+ */
+typedef std::function<void(unsigned int, const unsigned short*)> row_writer;
+
+/**
+ * Scratch memory of one thread during quantization.
+ */
+struct quantization_chunk {
+    /// Color cache used for smaller images.
+    std::unordered_map<unsigned int, unsigned int> cache_map;
+
+    /// The index of the closest comparison color of each pixel in the current row.
+    std::vector<unsigned short> closest;
+
+    /// The current row in CIE L*a*b*, when using fast color conversion.
+    std::vector<float> l;
+    std::vector<float> a;
+    std::vector<float> b;
+};
+
+/**
+ * State shared by all rows of an image during quantization: the converted comparison colors and the color cache.
+ * Set up once per image with setup_quantization, after which the image can be quantized in any number of bands.
+ * Setting it up for another image keeps the memory, and keeps the cached colors if the comparison colors and method are unchanged.
+ */
+struct quantization_state {
+    /// The background colors followed by the color layer colors.
+    std::vector<ptg_color> comparison_colors;
+
+    /// The comparison colors in CIE L*a*b*, for the CIE methods.
+    std::vector<cie_lab> comparison_colors_lab;
+
+    /// The method the cached colors were found with.
+    ptg_quantization_method quantization_method;
+
+    /// Whether to cache the closest comparison color of each color.
+    bool cache_colors;
+
+    /// Color cache table covering every 24-bit color, shared between all threads. Empty unless the image is large.
+    std::vector<std::atomic<unsigned short>> cache_table;
+
+    /// Scratch memory of each thread.
+    std::vector<quantization_chunk> chunks;
+
+    quantization_state() : quantization_method(PTG_EUCLIDEAN_SRGB), cache_colors(false) {}
+};
+
+/*
+ * Set up quantization state for an image.
+ * @param parameters Image input parameters.
+ * @param quantization_parameters Quantization parameters.
+ * @param out_state The state to set up.
+ */
+void setup_quantization(const ptg_image_parameters* parameters, const ptg_quantization_parameters* quantization_parameters, quantization_state& out_state);
+
+/*
+ * Quantize image one row at a time using quantization state that is already set up.
+ * @param state State set up for the image, or for the image the rows are a band of.
+ * @param parameters Image input parameters.
+ * @param quantization_parameters Quantization parameters. Must be the ones the state was set up with.
+ * @param write_row Function to pass the quantized rows to. Called concurrently for different rows when quantizing on several threads.
+ */
+void quantize_rows(quantization_state& state, const ptg_image_parameters* parameters, const ptg_quantization_parameters* quantization_parameters, const row_writer& write_row);
+
+/*
+ * Quantize image one row at a time.
+ * @param parameters Image input parameters.
+ * @param quantization_parameters Quantization parameters.
+ * @param write_row Function to pass the quantized rows to. Called concurrently for different rows when quantizing on several threads.
+ */
+void quantize_rows(const ptg_image_parameters* parameters, const ptg_quantization_parameters* quantization_parameters, const row_writer& write_row);
 
 /*
  * Quantize an image.
  * @param parameters Image input parameters.
  * @param layers Color layers to store results in.
- * @param quantization_method What method to use when quantizing the image.
+ * @param quantization_parameters Which method to use when quantizing the image and how many threads to use.
+ */
+void quantize(const ptg_image_parameters* parameters, bool** layers, const ptg_quantization_parameters* quantization_parameters);
+
+/*
+ * Quantize image into bit-packed layers.
+ * @param parameters Image input parameters.
+ * @param layers Color layers to store results in. Every row starts on a new 64-bit word.
+ * @param words_per_row The number of words per row.
+ * @param quantization_parameters Quantization parameters.
+ */
+void quantize_packed(const ptg_image_parameters* parameters, unsigned long long** layers, unsigned int words_per_row, const ptg_quantization_parameters* quantization_parameters);
+
+/*
+ * Quantize image into bit-packed layers using quantization state that is already set up.
+ * @param state State set up for the image, or for the image the rows are a band of.
+ * @param parameters Image input parameters.
+ * @param layers Color layers to store results in. Every row starts on a new 64-bit word.
+ * @param words_per_row The number of words per row.
+ * @param quantization_parameters Quantization parameters. Must be the ones the state was set up with.
+ */
+void quantize_packed(quantization_state& state, const ptg_image_parameters* parameters, unsigned long long** layers, unsigned int words_per_row, const ptg_quantization_parameters* quantization_parameters);
+
+/*
+ * Quantize image into a label image.
+ * @param parameters Image input parameters.
+ * @param labels Label image to store the layer of every pixel in. Pixels closest to a background color get color_layer_count.
+ * @param quantization_parameters Quantization parameters.
+ */
+void quantize_labels(const ptg_image_parameters* parameters, unsigned short* labels, const ptg_quantization_parameters* quantization_parameters);
+
+/*
+ * Find the closest background or color layer color of a list of colors.
+ * @param parameters Image input parameters. Only the background and color layer colors are used.
+ * @param colors The colors to find the closest color of.
+ * @param color_count The number of colors.
+ * @param quantization_method What method to use when comparing colors.
+ * @param thread_count Number of threads to split the colors between.
+ * @param out_indices Array to store the index of each color's closest color in. Background colors come first, followed by the color layer colors.
  */
-void quantize(const ptg_image_parameters* parameters, bool** layers, ptg_quantization_method quantization_method);
+void find_closest_colors(const ptg_image_parameters* parameters, const ptg_color* colors, unsigned int color_count, ptg_quantization_method quantization_method, unsigned int thread_count, unsigned short* out_indices);
 
 #endif
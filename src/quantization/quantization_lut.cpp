@@ -0,0 +1,135 @@
+#include "quantization_lut.hpp"
+
+#include <algorithm>
+#include <vector>
+#include "quantization.hpp"
+#include "../threading/parallel_for.hpp"
+
+// Number of entries in a lookup table (one per 24-bit color).
+static const unsigned int lut_size = 1 << 24;
+
+// Get the index of a color in a lookup table.
+static inline unsigned int lut_index(unsigned int r, unsigned int g, unsigned int b) {
+    return (r << 16) | (g << 8) | b;
+}
+
+/*
+ * Convert the index of a comparison color to the layer stored in a lookup table.
+ * Background colors map to one past the last color layer.
+ * @param parameters Image input parameters.
+ * @param index Index of the comparison color.
+ * @return The layer.
+ */
+static inline unsigned short to_layer(const ptg_image_parameters* parameters, unsigned short index) {
+    return (index < parameters->background_color_count) ? parameters->color_layer_count : index - parameters->background_color_count;
+}
+
+/*
+ * Find the layers of a list of colors and store them in the lookup table.
+ * @param parameters Image input parameters.
+ * @param quantization_method What method to use when comparing colors.
+ * @param colors The colors to find the layers of.
+ * @param lut The lookup table to store the layers in.
+ */
+static void find_layers(const ptg_image_parameters* parameters, ptg_quantization_method quantization_method, const std::vector<ptg_color>& colors, ptg_quantization_lut* lut) {
+    std::vector<unsigned short> indices(colors.size());
+    find_closest_colors(parameters, colors.data(), (unsigned int)colors.size(), quantization_method, 1, indices.data());
+
+    for (std::size_t i = 0; i < colors.size(); ++i) {
+        const ptg_color& color = colors[i];
+        lut->entries[lut_index(color.r, color.g, color.b)] = to_layer(parameters, indices[i]);
+    }
+}
+
+/*
+ * Find the layers of all colors in a box of the RGB cube and store them in the lookup table.
+ * @param parameters Image input parameters.
+ * @param quantization_method What method to use when comparing colors.
+ * @param r_start Red channel of the first color in the box.
+ * @param g_start Green channel of the first color in the box.
+ * @param b_start Blue channel of the first color in the box.
+ * @param r_size The size of the box along the red channel.
+ * @param gb_size The size of the box along the green and blue channels.
+ * @param lut The lookup table to store the layers in.
+ */
+static void find_box_layers(const ptg_image_parameters* parameters, ptg_quantization_method quantization_method, unsigned int r_start, unsigned int g_start, unsigned int b_start, unsigned int r_size, unsigned int gb_size, ptg_quantization_lut* lut) {
+    std::vector<ptg_color> colors;
+    colors.reserve(r_size * gb_size * gb_size);
+    for (unsigned int r = r_start; r < r_start + r_size; ++r)
+        for (unsigned int g = g_start; g < g_start + gb_size; ++g)
+            for (unsigned int b = b_start; b < b_start + gb_size; ++b)
+                colors.push_back({ (unsigned char)r, (unsigned char)g, (unsigned char)b });
+
+    find_layers(parameters, quantization_method, colors, lut);
+}
+
+void ptgi_create_quantization_lut(const ptg_image_parameters* parameters, const ptg_quantization_parameters* quantization_parameters, unsigned int subsample_bits, ptg_quantization_lut* out_lut) {
+    out_lut->color_layer_count = parameters->color_layer_count;
+    out_lut->entries = new unsigned short[lut_size];
+
+    const ptg_quantization_method quantization_method = quantization_parameters->quantization_method;
+    const unsigned int thread_count = quantization_parameters->thread_count;
+
+    // Compare every color, one red plane at a time.
+    if (subsample_bits == 0) {
+        ptgi_parallel_for(256, thread_count, [&](unsigned int first_r, unsigned int last_r) {
+            for (unsigned int r = first_r; r < last_r; ++r)
+                find_box_layers(parameters, quantization_method, r, 0, 0, 1, 256, out_lut);
+        });
+        return;
+    }
+
+    // Sample the RGB cube at every step'th value of each channel, including the far edge.
+    if (subsample_bits > 7)
+        subsample_bits = 7;
+    const unsigned int step = 1 << subsample_bits;
+    const unsigned int cell_count = 256 >> subsample_bits;
+    const unsigned int grid_size = cell_count + 1;
+
+    std::vector<ptg_color> grid_colors;
+    grid_colors.reserve(grid_size * grid_size * grid_size);
+    for (unsigned int r = 0; r < grid_size; ++r)
+        for (unsigned int g = 0; g < grid_size; ++g)
+            for (unsigned int b = 0; b < grid_size; ++b)
+                grid_colors.push_back({ (unsigned char)std::min(r * step, 255u), (unsigned char)std::min(g * step, 255u), (unsigned char)std::min(b * step, 255u) });
+
+    std::vector<unsigned short> grid_indices(grid_colors.size());
+    find_closest_colors(parameters, grid_colors.data(), (unsigned int)grid_colors.size(), quantization_method, thread_count, grid_indices.data());
+
+    // Cells whose eight corners agree are filled directly. The rest are refined by comparing every color in them.
+    ptgi_parallel_for(cell_count, thread_count, [&](unsigned int first_r, unsigned int last_r) {
+        for (unsigned int r = first_r; r < last_r; ++r) {
+            for (unsigned int g = 0; g < cell_count; ++g) {
+                for (unsigned int b = 0; b < cell_count; ++b) {
+                    const unsigned short corner = grid_indices[(r * grid_size + g) * grid_size + b];
+                    bool uniform = true;
+                    for (unsigned int i = 1; i < 8 && uniform; ++i)
+                        uniform = grid_indices[((r + (i >> 2)) * grid_size + g + ((i >> 1) & 1)) * grid_size + b + (i & 1)] == corner;
+
+                    if (!uniform) {
+                        find_box_layers(parameters, quantization_method, r * step, g * step, b * step, step, step, out_lut);
+                        continue;
+                    }
+
+                    const unsigned short layer = to_layer(parameters, corner);
+                    for (unsigned int r_offset = 0; r_offset < step; ++r_offset)
+                        for (unsigned int g_offset = 0; g_offset < step; ++g_offset)
+                            for (unsigned int b_offset = 0; b_offset < step; ++b_offset)
+                                out_lut->entries[lut_index(r * step + r_offset, g * step + g_offset, b * step + b_offset)] = layer;
+                }
+            }
+        }
+    });
+}
+
+void ptgi_quantize_with_lut(const ptg_image_parameters* parameters, const ptg_quantization_lut* lut, bool** layers) {
+    const unsigned int pixel_count = parameters->width * parameters->height;
+    for (unsigned int i = 0; i < pixel_count; ++i) {
+        const ptg_color& color = parameters->image[i];
+        const unsigned short layer = lut->entries[lut_index(color.r, color.g, color.b)];
+
+        // Write color layers.
+        for (unsigned int l = 0; l < lut->color_layer_count; ++l)
+            layers[l][i] = (l == layer);
+    }
+}
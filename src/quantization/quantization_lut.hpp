@@ -0,0 +1,23 @@
+#ifndef QUANTIZATION_LUT_HPP
+#define QUANTIZATION_LUT_HPP
+
+#include <photogeo.h>
+
+/*
+ * Create a lookup table mapping every 24-bit color to the layer it is quantized to.
+ * @param parameters Image input parameters. Only the background and color layer colors are used.
+ * @param quantization_parameters Which method to use when comparing colors and how many threads to use.
+ * @param subsample_bits How many low bits of each channel to skip when sampling colors (0-7).
+ * @param out_lut Variable to store the lookup table in.
+ */
+void ptgi_create_quantization_lut(const ptg_image_parameters* parameters, const ptg_quantization_parameters* quantization_parameters, unsigned int subsample_bits, ptg_quantization_lut* out_lut);
+
+/*
+ * Quantize an image using a lookup table.
+ * @param parameters Image input parameters.
+ * @param lut Lookup table to quantize with.
+ * @param layers Color layers to store results in.
+ */
+void ptgi_quantize_with_lut(const ptg_image_parameters* parameters, const ptg_quantization_lut* lut, bool** layers);
+
+#endif
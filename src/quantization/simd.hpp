@@ -0,0 +1,22 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+// SSE2 is part of every x86-64 CPU, so it can be used without checking for support.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define PTGI_SSE2
+    #include <emmintrin.h>
+#endif
+
+// AVX2 code is compiled separately and only used if the CPU supports it.
+#if defined(PTGI_SSE2) && (defined(__GNUC__) || defined(_MSC_VER))
+    #define PTGI_AVX2
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define PTGI_TARGET_AVX2
+    #else
+        #define PTGI_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+#endif
@@ -0,0 +1,105 @@
+#include "parallel_for.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+void ptgi_parallel_for(unsigned int count, unsigned int thread_count, const std::function<void(unsigned int, unsigned int)>& function) {
+    // Never use more threads than there are items.
+    if (thread_count > count)
+        thread_count = count;
+
+    if (thread_count <= 1) {
+        function(0, count);
+        return;
+    }
+
+    // Spread the remainder over the first chunks so no chunk differs by more than one item.
+    const unsigned int chunk_size = count / thread_count;
+    const unsigned int remainder = count % thread_count;
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    unsigned int begin = chunk_size + (remainder > 0);
+    for (unsigned int chunk = 1; chunk < thread_count; ++chunk) {
+        const unsigned int end = begin + chunk_size + (chunk < remainder);
+        threads.push_back(std::thread(function, begin, end));
+        begin = end;
+    }
+
+    // Process the first chunk on the calling thread.
+    function(0, chunk_size + (remainder > 0));
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+void ptgi_parallel_for_each(unsigned int count, unsigned int thread_count, const std::function<void(unsigned int)>& function) {
+    // Never use more threads than there are items.
+    if (thread_count > count)
+        thread_count = count;
+
+    if (thread_count <= 1) {
+        for (unsigned int i = 0; i < count; ++i)
+            function(i);
+        return;
+    }
+
+    // Each thread takes the next unprocessed item until there are none left.
+    std::atomic<unsigned int> next(0);
+    auto worker = [&]() {
+        for (unsigned int i = next++; i < count; i = next++)
+            function(i);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (unsigned int thread = 1; thread < thread_count; ++thread)
+        threads.push_back(std::thread(worker));
+
+    worker();
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+void ptgi_parallel_for_each_largest_first(unsigned int count, unsigned int thread_count, const std::function<unsigned int(unsigned int)>& size, const std::function<void(unsigned int, unsigned int)>& function) {
+    // Never use more threads than there are items.
+    if (thread_count > count)
+        thread_count = count;
+
+    if (thread_count <= 1) {
+        for (unsigned int i = 0; i < count; ++i)
+            function(i, 0);
+        return;
+    }
+
+    // Order the items by size, largest first.
+    std::vector<unsigned int> sizes(count);
+    std::vector<unsigned int> order(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        sizes[i] = size(i);
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&sizes](unsigned int a, unsigned int b) {
+        return sizes[a] > sizes[b];
+    });
+
+    // Each thread takes the next unprocessed item until there are none left.
+    std::atomic<unsigned int> next(0);
+    auto worker = [&](unsigned int thread) {
+        for (unsigned int i = next++; i < count; i = next++)
+            function(order[i], thread);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (unsigned int thread = 1; thread < thread_count; ++thread)
+        threads.push_back(std::thread(worker, thread));
+
+    worker(0);
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
@@ -0,0 +1,35 @@
+#ifndef PARALLEL_FOR_HPP
+#define PARALLEL_FOR_HPP
+
+#include <functional>
+
+/**
+ * Split a range into contiguous chunks and process them on multiple threads.
+ * The calling thread processes the first chunk and waits for the others to finish.
+ * @param count Number of items in the range.
+ * @param thread_count Number of threads to use. 0 or 1 processes the whole range on the calling thread.
+ * @param function Function to call for each chunk with the first item and one past the last item.
+ */
+void ptgi_parallel_for(unsigned int count, unsigned int thread_count, const std::function<void(unsigned int, unsigned int)>& function);
+
+/**
+ * Process items on multiple threads, handing out one item at a time to whichever thread is free.
+ * Suits items whose cost varies a lot. The calling thread takes part and waits for the others to finish.
+ * @param count Number of items.
+ * @param thread_count Number of threads to use. 0 or 1 processes all items on the calling thread.
+ * @param function Function to call for each item with its index.
+ */
+void ptgi_parallel_for_each(unsigned int count, unsigned int thread_count, const std::function<void(unsigned int)>& function);
+
+/**
+ * Process items on multiple threads like ptgi_parallel_for_each, handing out the largest items first.
+ * Keeps a large item from being started last while the other threads run out of work.
+ * @param count Number of items.
+ * @param thread_count Number of threads to use. 0 or 1 processes all items on the calling thread, in order.
+ * @param size Function returning the size of an item, used to order the items.
+ * @param function Function to call for each item with its index and the index of the thread processing it.
+ * Thread indices are less than thread_count, with 0 being the calling thread, so each thread can be given its own scratch memory.
+ */
+void ptgi_parallel_for_each_largest_first(unsigned int count, unsigned int thread_count, const std::function<unsigned int(unsigned int)>& size, const std::function<void(unsigned int, unsigned int)>& function);
+
+#endif
@@ -1,17 +1,63 @@
 #include "marching_squares.hpp"
 
+#include <algorithm>
 #include <assert.h>
 #include <cstring>
+#include <deque>
 #include <limits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
+#include "../threading/parallel_for.hpp"
+
+// Nodes used in marching squares and contour tracing.
+// Configurations are stored two to a byte, and whether nodes are assigned a contour one bit per node.
+class node_grid {
+    public:
+        /*
+         * Allocate nodes for a layer, reusing the layer's node memory.
+         * @param layer_width Width of the layer.
+         * @param layer_height Height of the layer.
+         * @param layer The layer to store the nodes in.
+         */
+        node_grid(unsigned int layer_width, unsigned int layer_height, traced_layer& layer) : configurations(layer.node_configurations), assigned(layer.assigned_nodes) {
+            // Rows start on a new byte, so rows of configurations can be filled a byte at a time.
+            stride = (layer_width + 2) & ~1u;
+            configurations.assign(stride / 2 * (layer_height + 1), 0);
+            assigned.assign((stride * (layer_height + 1) + 63) / 64, 0);
+        }
+
+        // Number of nodes per row, including padding.
+        unsigned int stride;
 
-// Node is used in marching squares and contour tracing.
-struct node {
-    // Configuration id.
-    int configuration;
+        // Get the configuration of the node at an index.
+        int configuration(unsigned int index) const {
+            return (configurations[index / 2] >> ((index & 1) * 4)) & 15;
+        }
+
+        // Set the configuration of the node at an index. Only nodes that haven't been set since allocation can be set.
+        void set_configuration(unsigned int index, int configuration) {
+            configurations[index / 2] |= (unsigned char)(configuration << ((index & 1) * 4));
+        }
+
+        // Set the configuration of an even number of nodes, starting at an even index.
+        void fill_configurations(unsigned int index, unsigned int count, int configuration) {
+            memset(&configurations[index / 2], configuration * 0x11, count / 2);
+        }
+
+        // Whether the node at an index is assigned a contour.
+        bool is_assigned(unsigned int index) const {
+            return (assigned[index / 64] >> (index % 64)) & 1;
+        }
 
-    // Whether node is assigned a contour.
-    bool assigned;
+        // Mark the node at an index as assigned a contour.
+        void assign(unsigned int index) {
+            assigned[index / 64] |= 1ull << (index % 64);
+        }
+
+    private:
+        std::vector<unsigned char, container_allocator<unsigned char>>& configurations;
+        std::vector<unsigned long long, container_allocator<unsigned long long>>& assigned;
 };
 
 // Direction describes which direction the contour is heading during contour tracing.
@@ -28,12 +74,12 @@ enum  direction {
  * @param x X-coordinate in pixels (positive right).
  * @param y Y-coordinate in pixels (positive down).
  * @param direction Current direction of the contour.
- * @param node The node to decode.
+ * @param configuration The configuration of the node to decode.
  * @param out_v0 The first vertex.
  * @param out_v1 The second vertex.
  * @return Which direction the contour is heading.
  */
-static direction calculate_node(unsigned int x, unsigned int y, direction direction, const node& node, ptg_vec2& out_v0, ptg_vec2& out_v1) {
+static direction calculate_node(unsigned int x, unsigned int y, direction direction, int configuration, ptg_vec2& out_v0, ptg_vec2& out_v1) {
     // Convert (x,y) from pixel space to mesh space.
     x = x * 2;
     y = y * 2;
@@ -50,7 +96,7 @@ static direction calculate_node(unsigned int x, unsigned int y, direction direct
     const ptg_vec2 C = { x, y + 1 };
     const ptg_vec2 D = { x - 1, y };
 
-    switch (node.configuration) {
+    switch (configuration) {
         // 0 points:
         case 0:
             return NONE;
@@ -166,88 +212,641 @@ static direction calculate_node(unsigned int x, unsigned int y, direction direct
     }
 }
 
-void ptgi_trace_marching_squares(bool* layer, unsigned int layer_width, unsigned int layer_height, ptg_outline*& out_outlines, unsigned int& out_outline_count) {
-    // Allocate nodes.
-    node* nodes = new node[(layer_width + 1) * (layer_height + 1)];
-    std::vector<unsigned int> root_indices;
-
-    // Execute marching squares on layer.
-    for (unsigned int it = 0; it < ((layer_width + 1) * (layer_height + 1)); ++it) {
-        unsigned int it_x = it % (layer_width + 1);
-        unsigned int it_y = it / (layer_width + 1);
-
-        bool top_edge = it_y == 0;
-        bool bottom_edge = it_y == layer_height;
-        bool left_edge = it_x == 0;
-        bool right_edge = it_x == layer_width;
-
-        bool top_left = top_edge || left_edge ? false : layer[it_x - 1 + (it_y - 1) * layer_width];
-        bool top_right = top_edge || right_edge ? false : layer[it_x + (it_y - 1) * layer_width];
-        bool bottom_right = bottom_edge || right_edge ? false : layer[it_x + it_y * layer_width];
-        bool bottom_left = bottom_edge || left_edge ? false : layer[it_x - 1 + it_y * layer_width];
-
-        int configuration = top_left * 8 + top_right * 4 + bottom_right * 2 + bottom_left * 1;
-
-        // Calculate current configuration of marching squares.
-        nodes[it] = { configuration, false };
-        // Add root if configuration is 2, 7 or 10
-        if ((configuration == 2) || (configuration == 7) || (configuration == 10))
-            root_indices.push_back(it);
+/*
+ * Find the outline directly enclosing each outline and whether it is a hole.
+ * Every edge between a layer pixel and another pixel is crossed by exactly one outline vertex, which has odd y in mesh space.
+ * Scanning those crossings row by row, the pixels left of an outline's first crossing lie in the region directly outside it, which is bordered by the outline of the previous crossing.
+ * @param layer The outlines of a layer. Its parents and holes are set.
+ */
+static void find_hierarchy(traced_layer& layer) {
+    // The last vertex of an outline repeats the first.
+    const unsigned int outline_count = layer.outline_count();
+    auto& crossings = layer.crossings;
+    crossings.clear();
+    for (unsigned int outline_index = 0; outline_index < outline_count; ++outline_index) {
+        for (unsigned int vertex_index = layer.vertex_offsets[outline_index]; vertex_index + 1 < layer.vertex_offsets[outline_index + 1]; ++vertex_index) {
+            const ptg_vec2& vertex = layer.vertices[vertex_index];
+            if (vertex.y & 1)
+                crossings.push_back({ vertex.y, vertex.x, outline_index });
+        }
     }
+    std::sort(crossings.begin(), crossings.end(), [](const outline_crossing& a, const outline_crossing& b) {
+        return a.y < b.y || (a.y == b.y && a.x < b.x);
+    });
+
+    layer.parents.assign(outline_count, PTG_NO_PARENT);
+    layer.holes.assign(outline_count, false);
+    auto& found = layer.found_outlines;
+    found.assign(outline_count, false);
+    std::size_t row_start = 0;
+    for (std::size_t i = 0; i < crossings.size(); ++i) {
+        if (crossings[i].y != crossings[row_start].y)
+            row_start = i;
+
+        const unsigned int outline_index = crossings[i].outline;
+        if (found[outline_index])
+            continue;
+        found[outline_index] = true;
+
+        // The pixels right of the even crossings of a row belong to the layer, and the pixels right of an outline's first crossing lie inside it.
+        layer.holes[outline_index] = (i - row_start) % 2 != 0;
+        if (i == row_start)
+            continue;
+
+        // The region between the crossings lies inside the previous outline if it is as much part of the layer as the inside of that outline.
+        const unsigned int previous = crossings[i - 1].outline;
+        const bool region_in_layer = (i - 1 - row_start) % 2 == 0;
+        layer.parents[outline_index] = (region_in_layer != layer.holes[previous]) ? previous : layer.parents[previous];
+    }
+}
 
-    // Create contours.
-    std::vector<std::vector<ptg_vec2>> contours;
-    for (int root_index : root_indices) {
-        node* node_root = &nodes[root_index];
-
-        if (!node_root->assigned) {
-            // Create new contour.
-            contours.push_back(std::vector<ptg_vec2>());
-            std::vector<ptg_vec2>& contour = contours.back();
+/*
+ * Trace the contours of a layer whose node configurations and root indices have been calculated.
+ * @param nodes The nodes of the layer.
+ * @param out_layer Variable to store resulting outlines.
+ */
+static void trace_contours(node_grid& nodes, traced_layer& out_layer) {
+    // Create contours, appending their vertices to the layer's.
+    auto& vertices = out_layer.vertices;
+    for (unsigned int root_index : out_layer.root_indices) {
+        if (!nodes.is_assigned(root_index)) {
+            const std::size_t first_vertex = vertices.size();
 
             unsigned int it = root_index;
-            unsigned int x = it % (layer_width + 1);
-            unsigned int y = it / (layer_width + 1);
-            direction direction = (node_root->configuration == 10) ? UP : RIGHT;
-            node* node_it = node_root;
+            unsigned int x = it % nodes.stride;
+            unsigned int y = it / nodes.stride;
+            direction direction = (nodes.configuration(root_index) == 10) ? UP : RIGHT;
             ptg_vec2 v0, v1;
 
             // Trace contour.
             do {
                 // Calculating the nodes vertices and direction.
-                direction = calculate_node(x, y, direction, *node_it, v0, v1);
+                const int configuration = nodes.configuration(it);
+                direction = calculate_node(x, y, direction, configuration, v0, v1);
                 assert(direction != NONE);
 
                 // Add vertex to contour.
-                contour.push_back(v0);
+                vertices.push_back(v0);
 
                 // Set node as assigned to contour expect when tracing configuration 10 and direction is left.
-                if (node_it->configuration != 10 || direction != LEFT)
-                    node_it->assigned = true;
+                if (configuration != 10 || direction != LEFT)
+                    nodes.assign(it);
 
                 // Find connected node.
                 x = x + (direction == RIGHT) - (direction == LEFT);
                 y = y + (direction == DOWN) - (direction == UP);
-                it = x + y * (layer_width + 1);
-                node_it = &nodes[it];
-            } while (node_it != node_root || direction == DOWN);
+                it = x + y * nodes.stride;
+            } while (it != root_index || direction == DOWN);
 
             // Finish contour by connecting tail and root.
-            contour.push_back(contour.front());
+            const ptg_vec2 root = vertices[first_vertex];
+            vertices.push_back(root);
+            out_layer.vertex_offsets.push_back((unsigned int)vertices.size());
+        }
+    }
+
+    find_hierarchy(out_layer);
+}
+
+// Whether contours can start at a node with this configuration.
+static inline bool is_root(int configuration) {
+    return (configuration == 2) || (configuration == 7) || (configuration == 10);
+}
+
+/*
+ * Calculate the configurations of a row of nodes.
+ * Each pixel is only read once per row, sliding the right pixels of one node over to become the left pixels of the next.
+ * @param in_layer Function returning whether the pixel at (x, y) belongs to the layer.
+ * @param y Y-coordinate of the nodes. Lies between pixel row y - 1 and pixel row y.
+ * @param x0 X-coordinate of the first node.
+ * @param x1 X-coordinate one past the last node.
+ * @param layer_width Width of the layer.
+ * @param layer_height Height of the layer.
+ * @param store Function to call with the x-coordinate and configuration of every node.
+ */
+template<typename in_layer_function, typename store_function>
+static inline void calculate_configurations(in_layer_function& in_layer, unsigned int y, unsigned int x0, unsigned int x1, unsigned int layer_width, unsigned int layer_height, store_function store) {
+    const bool top_edge = y == 0;
+    const bool bottom_edge = y == layer_height;
+
+    // Node x lies between pixel x - 1 and pixel x.
+    bool top_left = top_edge || x0 == 0 ? false : in_layer(x0 - 1, y - 1);
+    bool bottom_left = bottom_edge || x0 == 0 ? false : in_layer(x0 - 1, y);
+    for (unsigned int x = x0; x < x1; ++x) {
+        const bool right_edge = x == layer_width;
+        const bool top_right = top_edge || right_edge ? false : in_layer(x, y - 1);
+        const bool bottom_right = bottom_edge || right_edge ? false : in_layer(x, y);
+
+        store(x, top_left * 8 + top_right * 4 + bottom_right * 2 + bottom_left * 1);
+
+        top_left = top_right;
+        bottom_left = bottom_right;
+    }
+}
+
+/*
+ * Trace a layer using marching squares.
+ * @param in_layer Function returning whether the pixel at (x, y) belongs to the layer.
+ * @param layer_width Width of the layer.
+ * @param layer_height Height of the layer.
+ * @param out_layer Variable to store resulting outlines.
+ */
+template<typename in_layer_function>
+static void trace_helper(in_layer_function in_layer, unsigned int layer_width, unsigned int layer_height, traced_layer& out_layer) {
+    // Allocate nodes.
+    node_grid nodes(layer_width, layer_height, out_layer);
+    auto& root_indices = out_layer.root_indices;
+    root_indices.clear();
+
+    // Execute marching squares on layer, one row of nodes at a time.
+    for (unsigned int y = 0; y <= layer_height; ++y) {
+        const unsigned int row = y * nodes.stride;
+        calculate_configurations(in_layer, y, 0, layer_width + 1, layer_width, layer_height, [&](unsigned int x, int configuration) {
+            // Calculate current configuration of marching squares.
+            nodes.set_configuration(row + x, configuration);
+            // Add root if configuration is 2, 7 or 10
+            if (is_root(configuration))
+                root_indices.push_back(row + x);
+        });
+    }
+
+    // Create contours and outlines.
+    trace_contours(nodes, out_layer);
+}
+
+/*
+ * Part of a contour that passes through a tile.
+ * Segments are identified by the node they belong to and the direction the contour arrives at the node in, since a node has at most one segment per direction.
+ */
+struct fragment {
+    // Key of the first segment in the fragment.
+    unsigned long long entry;
+
+    // Key of the first segment after the fragment, in another tile.
+    unsigned long long exit;
+
+    // Index of the first node in the fragment contours can start at, or no_root.
+    unsigned long long root;
+
+    // Index of the vertex of that node.
+    unsigned int root_position;
+
+    // The first vertex of every segment in the fragment.
+    std::vector<ptg_vec2> vertices;
+};
+
+// Contour together with the index of the node it starts at.
+struct rooted_contour {
+    // Index of the node the contour starts at.
+    unsigned long long root;
+
+    // The vertices of the contour.
+    std::vector<ptg_vec2> vertices;
+};
+
+// Marks fragments without any node contours can start at.
+static const unsigned long long no_root = std::numeric_limits<unsigned long long>::max();
+
+// Direction a contour arrives at a node in for the first and second segment of each configuration.
+static const direction segment_arrivals[16][2] = {
+    { NONE, NONE }, { RIGHT, NONE }, { UP, NONE }, { RIGHT, NONE },
+    { LEFT, NONE }, { RIGHT, LEFT }, { UP, NONE }, { RIGHT, NONE },
+    { DOWN, NONE }, { DOWN, NONE }, { UP, DOWN }, { DOWN, NONE },
+    { LEFT, NONE }, { LEFT, NONE }, { UP, NONE }, { NONE, NONE }
+};
+
+// Get the index of the node at (x, y). 64-bit, since layers traced a few rows at a time can have more nodes than fit in 32 bits.
+static inline unsigned long long node_key(unsigned int x, unsigned int y, unsigned int layer_width) {
+    return (unsigned long long)y * (layer_width + 1) + x;
+}
+
+// Get the key of the segment a contour follows when arriving at a node in a direction.
+static inline unsigned long long segment_key(unsigned long long node_index, direction arrival) {
+    return (unsigned long long)node_index * 4 + (arrival - 1);
+}
+
+/*
+ * Trace the contours passing through one tile of nodes.
+ * Contours that leave the tile are stored as fragments, contours completely inside the tile as finished contours.
+ * @param in_layer Function returning whether the pixel at (x, y) belongs to the layer.
+ * @param layer_width Width of the layer.
+ * @param layer_height Height of the layer.
+ * @param x0 X-coordinate of the first node in the tile.
+ * @param y0 Y-coordinate of the first node in the tile.
+ * @param x1 X-coordinate one past the last node in the tile.
+ * @param y1 Y-coordinate one past the last node in the tile.
+ * @param out_fragments Vector to add fragments to.
+ * @param out_contours Vector to add contours to.
+ */
+template<typename in_layer_function>
+static void trace_tile(in_layer_function& in_layer, unsigned int layer_width, unsigned int layer_height, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, std::vector<fragment>& out_fragments, std::vector<rooted_contour>& out_contours) {
+    const unsigned int tile_width = x1 - x0;
+
+    // Calculate configurations of the tile's nodes. Bit 0 and 1 of visited mark the first and second segment of a node as traced.
+    std::vector<unsigned char> configurations(tile_width * (y1 - y0));
+    std::vector<unsigned char> visited(configurations.size(), 0);
+    for (unsigned int y = y0; y < y1; ++y) {
+        unsigned char* row = &configurations[(y - y0) * tile_width] - x0;
+        calculate_configurations(in_layer, y, x0, x1, layer_width, layer_height, [row](unsigned int x, int configuration) {
+            row[x] = (unsigned char)configuration;
+        });
+    }
+
+    /*
+     * Follow a contour from a segment until it leaves the tile or returns to the segment.
+     * Returns the key of the segment outside the tile, or no_exit if the contour was closed.
+     */
+    const unsigned long long no_exit = std::numeric_limits<unsigned long long>::max();
+    auto follow = [&](unsigned int x, unsigned int y, direction arrival, std::vector<ptg_vec2>& vertices, unsigned long long& root, unsigned int& root_position) {
+        const unsigned int start_x = x;
+        const unsigned int start_y = y;
+        const direction start_arrival = arrival;
+        ptg_vec2 v0, v1;
+        do {
+            const unsigned int local_index = (y - y0) * tile_width + x - x0;
+            const int configuration = configurations[local_index];
+            const unsigned int segment = (segment_arrivals[configuration][1] == arrival) ? 1 : 0;
+            visited[local_index] |= 1 << segment;
+
+            // Remember the first node in scan order the contour can start at.
+            const unsigned long long node_index = node_key(x, y, layer_width);
+            if (is_root(configuration) && segment == 0 && (root == no_root || node_index < root)) {
+                root = node_index;
+                root_position = (unsigned int)vertices.size();
+            }
+
+            arrival = calculate_node(x, y, arrival, configuration, v0, v1);
+            assert(arrival != NONE);
+            vertices.push_back(v0);
+
+            // Find connected node.
+            x = x + (arrival == RIGHT) - (arrival == LEFT);
+            y = y + (arrival == DOWN) - (arrival == UP);
+            if (x < x0 || x >= x1 || y < y0 || y >= y1)
+                return segment_key(node_key(x, y, layer_width), arrival);
+        } while (x != start_x || y != start_y || arrival != start_arrival);
+
+        return no_exit;
+    };
+
+    // Trace fragments, starting at every segment entered from outside the tile.
+    for (unsigned int y = y0; y < y1; ++y) {
+        for (unsigned int x = x0; x < x1; ++x) {
+            const int configuration = configurations[(y - y0) * tile_width + x - x0];
+            for (unsigned int segment = 0; segment < 2; ++segment) {
+                const direction arrival = segment_arrivals[configuration][segment];
+                if (arrival == NONE)
+                    continue;
+
+                const unsigned int previous_x = x - (arrival == RIGHT) + (arrival == LEFT);
+                const unsigned int previous_y = y - (arrival == DOWN) + (arrival == UP);
+                if (previous_x >= x0 && previous_x < x1 && previous_y >= y0 && previous_y < y1)
+                    continue;
+
+                out_fragments.push_back(fragment());
+                fragment& entered = out_fragments.back();
+                entered.entry = segment_key(node_key(x, y, layer_width), arrival);
+                entered.root = no_root;
+                entered.root_position = 0;
+                entered.exit = follow(x, y, arrival, entered.vertices, entered.root, entered.root_position);
+                assert(entered.exit != no_exit);
+            }
         }
     }
 
-    // Create outlines.
-    out_outline_count = (unsigned int)contours.size();
-    out_outlines = new ptg_outline[out_outline_count];
-    for (std::size_t countour_index = 0; countour_index < contours.size(); ++countour_index) {
-        std::vector<ptg_vec2>& contour = contours[countour_index];
-        ptg_outline& out_outline = out_outlines[(unsigned int)countour_index];
-        out_outline.vertex_count = (unsigned int)contour.size();
-        out_outline.vertices = new ptg_vec2[out_outline.vertex_count];
-        memcpy(out_outline.vertices, contour.data(), sizeof(ptg_vec2) * out_outline.vertex_count);
+    // Whatever is left untraced are contours completely inside the tile. Scan order makes their first root the one they start at.
+    for (unsigned int y = y0; y < y1; ++y) {
+        for (unsigned int x = x0; x < x1; ++x) {
+            const unsigned int local_index = (y - y0) * tile_width + x - x0;
+            const int configuration = configurations[local_index];
+            if (!is_root(configuration) || (visited[local_index] & 1))
+                continue;
+
+            out_contours.push_back(rooted_contour());
+            rooted_contour& contour = out_contours.back();
+            unsigned long long root = no_root;
+            unsigned int root_position = 0;
+            follow(x, y, segment_arrivals[configuration][0], contour.vertices, root, root_position);
+            contour.root = root;
+            contour.vertices.push_back(contour.vertices.front());
+        }
     }
+}
+
+/*
+ * Joins fragments into contours as they are traced.
+ * Only chains of fragments that have not closed yet are kept, so memory is bounded by the contours crossing the border of what has been traced so far.
+ */
+class contour_stitcher {
+    public:
+        /*
+         * Add a fragment, joining it with the chains it connects to.
+         * @param traced The fragment. Its vertices are moved from.
+         */
+        void add_fragment(fragment& traced) {
+            chain current;
+            current.entry = traced.entry;
+            current.exit = traced.exit;
+            current.root = traced.root;
+            current.root_position = traced.root_position;
+            current.vertices.assign(traced.vertices.begin(), traced.vertices.end());
+            traced.vertices.clear();
+
+            // Join with the chain leading into the fragment.
+            auto previous = exits.find(current.entry);
+            if (previous != exits.end()) {
+                auto open = open_chains.find(previous->second);
+                chain first = std::move(open->second);
+                open_chains.erase(open);
+                exits.erase(previous);
+                current = join(first, current);
+            }
+
+            // Join with the chain the fragment leads into.
+            if (current.exit != current.entry) {
+                auto next = open_chains.find(current.exit);
+                if (next != open_chains.end()) {
+                    chain second = std::move(next->second);
+                    open_chains.erase(next);
+                    exits.erase(second.exit);
+                    current = join(current, second);
+                }
+            }
+
+            if (current.exit == current.entry) {
+                close(current);
+                return;
+            }
+
+            exits[current.exit] = current.entry;
+            open_chains.emplace(current.entry, std::move(current));
+        }
+
+        /*
+         * Add a contour that was traced whole.
+         * @param contour The contour. It is moved from.
+         */
+        void add_contour(rooted_contour& contour) {
+            contours.push_back(std::move(contour));
+        }
+
+        /*
+         * Create outlines from the finished contours, in the order they are found when scanning the whole layer.
+         * All chains must have been closed.
+         * @param out_layer Variable to store resulting outlines.
+         */
+        void finish(traced_layer& out_layer) {
+            assert(open_chains.empty());
+
+            std::sort(contours.begin(), contours.end(), [](const rooted_contour& a, const rooted_contour& b) {
+                return a.root < b.root;
+            });
+
+            for (const rooted_contour& contour : contours) {
+                out_layer.vertices.insert(out_layer.vertices.end(), contour.vertices.begin(), contour.vertices.end());
+                out_layer.vertex_offsets.push_back((unsigned int)out_layer.vertices.size());
+            }
+            contours.clear();
+
+            find_hierarchy(out_layer);
+        }
+
+    private:
+        // Fragments joined end to end.
+        struct chain {
+            unsigned long long entry;
+            unsigned long long exit;
+            unsigned long long root;
+            std::size_t root_position;
+            std::deque<ptg_vec2> vertices;
+        };
+
+        // Join two chains, copying the shorter one into the longer so that building a contour from many fragments stays cheap.
+        // The longer chain is moved into the result, so its vertices are never copied.
+        static chain join(chain& first, chain& second) {
+            if (first.vertices.size() >= second.vertices.size()) {
+                if (second.root < first.root) {
+                    first.root = second.root;
+                    first.root_position = first.vertices.size() + second.root_position;
+                }
+                first.vertices.insert(first.vertices.end(), second.vertices.begin(), second.vertices.end());
+                first.exit = second.exit;
+                return std::move(first);
+            }
+
+            second.root_position += first.vertices.size();
+            if (first.root < second.root) {
+                second.root = first.root;
+                second.root_position = first.root_position;
+            }
+            second.vertices.insert(second.vertices.begin(), first.vertices.begin(), first.vertices.end());
+            second.entry = first.entry;
+            return std::move(second);
+        }
+
+        // Turn a closed chain into a contour starting at its root.
+        void close(chain& closed) {
+            // The monolithic tracer never finds contours without a root either.
+            if (closed.root == no_root)
+                return;
+
+            contours.push_back(rooted_contour());
+            rooted_contour& contour = contours.back();
+            contour.root = closed.root;
+            contour.vertices.reserve(closed.vertices.size() + 1);
+            contour.vertices.insert(contour.vertices.end(), closed.vertices.begin() + closed.root_position, closed.vertices.end());
+            contour.vertices.insert(contour.vertices.end(), closed.vertices.begin(), closed.vertices.begin() + closed.root_position);
+            contour.vertices.push_back(contour.vertices.front());
+        }
+
+        // Open chains by the key of their first segment.
+        std::unordered_map<unsigned long long, chain> open_chains;
+
+        // Key of the first segment of open chains by the key of the segment after their last.
+        std::unordered_map<unsigned long long, unsigned long long> exits;
+
+        std::vector<rooted_contour> contours;
+};
+
+/*
+ * Trace a layer using marching squares, one tile at a time.
+ * Contours crossing tile borders are stitched together afterwards, giving the same outlines as trace_helper.
+ * @param in_layer Function returning whether the pixel at (x, y) belongs to the layer.
+ * @param layer_width Width of the layer.
+ * @param layer_height Height of the layer.
+ * @param tile_size Width and height of the tiles in nodes.
+ * @param thread_count Number of threads to trace tiles on.
+ * @param out_layer Variable to store resulting outlines.
+ */
+template<typename in_layer_function>
+static void trace_tiled_helper(in_layer_function in_layer, unsigned int layer_width, unsigned int layer_height, unsigned int tile_size, unsigned int thread_count, traced_layer& out_layer) {
+    const unsigned int tiles_x = (layer_width + tile_size) / tile_size;
+    const unsigned int tiles_y = (layer_height + tile_size) / tile_size;
+    const unsigned int tile_count = tiles_x * tiles_y;
+
+    // Trace tiles.
+    std::vector<std::vector<fragment>> tile_fragments(tile_count);
+    std::vector<std::vector<rooted_contour>> tile_contours(tile_count);
+    ptgi_parallel_for_each(tile_count, thread_count, [&](unsigned int tile) {
+        const unsigned int x0 = (tile % tiles_x) * tile_size;
+        const unsigned int y0 = (tile / tiles_x) * tile_size;
+        const unsigned int x1 = std::min(x0 + tile_size, layer_width + 1);
+        const unsigned int y1 = std::min(y0 + tile_size, layer_height + 1);
+        trace_tile(in_layer, layer_width, layer_height, x0, y0, x1, y1, tile_fragments[tile], tile_contours[tile]);
+    });
+
+    // Stitch fragments into contours.
+    contour_stitcher stitcher;
+    for (unsigned int tile = 0; tile < tile_count; ++tile) {
+        for (rooted_contour& contour : tile_contours[tile])
+            stitcher.add_contour(contour);
+        for (fragment& tile_fragment : tile_fragments[tile])
+            stitcher.add_fragment(tile_fragment);
+        tile_contours[tile].clear();
+        tile_fragments[tile].clear();
+    }
+
+    stitcher.finish(out_layer);
+}
+
+void ptgi_trace_marching_squares(bool* layer, unsigned int layer_width, unsigned int layer_height, unsigned int tile_size, unsigned int thread_count, traced_layer& out_layer) {
+    auto in_layer = [layer, layer_width](unsigned int x, unsigned int y) { return layer[x + y * layer_width]; };
+    if (tile_size > 0)
+        trace_tiled_helper(in_layer, layer_width, layer_height, tile_size, thread_count, out_layer);
+    else
+        trace_helper(in_layer, layer_width, layer_height, out_layer);
+}
+
+void ptgi_trace_marching_squares_labels(const unsigned short* labels, unsigned short label, unsigned int layer_width, unsigned int layer_height, unsigned int tile_size, unsigned int thread_count, traced_layer& out_layer) {
+    auto in_layer = [labels, label, layer_width](unsigned int x, unsigned int y) { return labels[x + y * layer_width] == label; };
+    if (tile_size > 0)
+        trace_tiled_helper(in_layer, layer_width, layer_height, tile_size, thread_count, out_layer);
+    else
+        trace_helper(in_layer, layer_width, layer_height, out_layer);
+}
+
+void ptgi_trace_marching_squares_packed(const unsigned long long* layer, unsigned int words_per_row, unsigned int layer_width, unsigned int layer_height, unsigned int tile_size, unsigned int thread_count, traced_layer& out_layer) {
+    if (tile_size > 0) {
+        auto in_layer = [layer, words_per_row](unsigned int x, unsigned int y) { return ((layer[y * words_per_row + x / 64] >> (x % 64)) & 1) != 0; };
+        trace_tiled_helper(in_layer, layer_width, layer_height, tile_size, thread_count, out_layer);
+        return;
+    }
+
+    // Allocate nodes.
+    node_grid nodes(layer_width, layer_height, out_layer);
+    auto& root_indices = out_layer.root_indices;
+    root_indices.clear();
+
+    // Execute marching squares on layer, one row of nodes at a time.
+    // Node x lies between pixel x - 1 and pixel x, so the nodes sharing a word with pixels also need the last pixel of the previous word.
+    const unsigned long long all_set = ~0ull;
+    for (unsigned int y = 0; y <= layer_height; ++y) {
+        const unsigned long long* top = (y > 0) ? layer + (y - 1) * words_per_row : nullptr;
+        const unsigned long long* bottom = (y < layer_height) ? layer + y * words_per_row : nullptr;
+        const unsigned int row = y * nodes.stride;
+
+        for (unsigned int word = 0; word * 64 <= layer_width; ++word) {
+            const unsigned long long top_word = (top != nullptr && word < words_per_row) ? top[word] : 0;
+            const unsigned long long bottom_word = (bottom != nullptr && word < words_per_row) ? bottom[word] : 0;
+            const unsigned int top_previous = (top != nullptr && word > 0) ? (unsigned int)(top[word - 1] >> 63) : 0;
+            const unsigned int bottom_previous = (bottom != nullptr && word > 0) ? (unsigned int)(bottom[word - 1] >> 63) : 0;
+
+            const unsigned int first = word * 64;
+            const unsigned int last = (first + 64 < layer_width + 1) ? first + 64 : layer_width + 1;
+
+            // 64 nodes outside of the layer. Nodes are allocated with configuration 0.
+            if ((top_word | bottom_word | top_previous | bottom_previous) == 0)
+                continue;
+
+            // 64 nodes inside of the layer. Padding bits past the width are 0, so only full words can be inside.
+            if (first + 64 <= layer_width && top_word == all_set && bottom_word == all_set && top_previous && bottom_previous) {
+                nodes.fill_configurations(row + first, 64, 15);
+                continue;
+            }
+
+            for (unsigned int x = first; x < last; ++x) {
+                const unsigned int bit = x - first;
+                const unsigned int top_left = (bit > 0) ? (unsigned int)(top_word >> (bit - 1)) & 1 : top_previous;
+                const unsigned int top_right = (unsigned int)(top_word >> bit) & 1;
+                const unsigned int bottom_right = (unsigned int)(bottom_word >> bit) & 1;
+                const unsigned int bottom_left = (bit > 0) ? (unsigned int)(bottom_word >> (bit - 1)) & 1 : bottom_previous;
+
+                const int configuration = top_left * 8 + top_right * 4 + bottom_right * 2 + bottom_left * 1;
+                nodes.set_configuration(row + x, configuration);
+                if (is_root(configuration))
+                    root_indices.push_back(row + x);
+            }
+        }
+    }
+
+    // Create contours and outlines.
+    trace_contours(nodes, out_layer);
+}
+
+// State of a layer being traced a few rows at a time.
+struct ptg_trace_stream {
+    // Width of the layer.
+    unsigned int layer_width;
+
+    // Number of rows pushed so far.
+    unsigned int row_count;
+
+    // The last two rows pushed. Only the nodes between them are traced at a time.
+    std::vector<unsigned char> previous_row;
+    std::vector<unsigned char> current_row;
+
+    // Contours still open at the last traced row of nodes.
+    contour_stitcher stitcher;
+};
+
+/*
+ * Trace the row of nodes above the last pushed row, or below it when the layer has ended.
+ * @param stream The stream.
+ * @param layer_height The height of the layer as far as the nodes are concerned.
+ */
+static void trace_stream_row(ptg_trace_stream* stream, unsigned int layer_height) {
+    const unsigned int y = stream->row_count;
+    const unsigned char* top = stream->previous_row.data();
+    const unsigned char* bottom = stream->current_row.data();
+    auto in_layer = [y, top, bottom](unsigned int x, unsigned int pixel_y) { return (pixel_y == y ? bottom[x] : top[x]) != 0; };
+
+    std::vector<fragment> fragments;
+    std::vector<rooted_contour> contours;
+    trace_tile(in_layer, stream->layer_width, layer_height, 0, y, stream->layer_width + 1, y + 1, fragments, contours);
+
+    for (rooted_contour& contour : contours)
+        stream->stitcher.add_contour(contour);
+    for (fragment& row_fragment : fragments)
+        stream->stitcher.add_fragment(row_fragment);
+}
+
+ptg_trace_stream* ptgi_trace_stream_begin(unsigned int layer_width) {
+    ptg_trace_stream* stream = new ptg_trace_stream();
+    stream->layer_width = layer_width;
+    stream->row_count = 0;
+    stream->previous_row.assign(layer_width, 0);
+    stream->current_row.assign(layer_width, 0);
+    return stream;
+}
+
+void ptgi_trace_stream_push_rows(ptg_trace_stream* stream, const bool* rows, unsigned int row_count) {
+    for (unsigned int row = 0; row < row_count; ++row) {
+        const bool* pixels = rows + row * stream->layer_width;
+        for (unsigned int x = 0; x < stream->layer_width; ++x)
+            stream->current_row[x] = pixels[x];
+
+        // The layer continues at least until the row that was just pushed.
+        trace_stream_row(stream, stream->row_count + 1);
+
+        stream->previous_row.swap(stream->current_row);
+        ++stream->row_count;
+    }
+}
+
+void ptgi_trace_stream_end(ptg_trace_stream* stream, traced_layer& out_layer) {
+    // Trace the nodes below the last row.
+    trace_stream_row(stream, stream->row_count);
 
-    // Delete nodes.
-    delete[] nodes;
+    stream->stitcher.finish(out_layer);
+    delete stream;
 }
@@ -2,16 +2,127 @@
 #define MARCHING_SQUARES_HPP
 
 #include <photogeo.h>
+#include <vector>
+#include "../memory/allocator.hpp"
+
+/**
+ * Outline vertex lying on a row of pixel centers. Used to find the hierarchy of outlines.
+ */
+struct outline_crossing {
+    unsigned int y;
+    unsigned int x;
+    unsigned int outline;
+};
+
+/**
+ * Outlines of a layer, with the vertices of all outlines in one buffer.
+ * The buffers and the memory used while tracing are allocated with the layer's allocator.
+ * Tracing into a layer again after clearing it reuses that memory.
+ */
+struct traced_layer {
+    /// The vertices of all outlines after each other. Every outline repeats its first vertex at the end.
+    std::vector<ptg_vec2, container_allocator<ptg_vec2>> vertices;
+
+    /// Index of the first vertex of every outline, followed by the number of vertices.
+    std::vector<unsigned int, container_allocator<unsigned int>> vertex_offsets;
+
+    /// Index of the outline directly enclosing every outline, or PTG_NO_PARENT.
+    std::vector<unsigned int, container_allocator<unsigned int>> parents;
+
+    /// Whether every outline bounds a hole.
+    std::vector<bool, container_allocator<bool>> holes;
+
+    /// Configurations of the nodes, two per byte.
+    std::vector<unsigned char, container_allocator<unsigned char>> node_configurations;
+
+    /// Whether each node is assigned a contour, one bit per node.
+    std::vector<unsigned long long, container_allocator<unsigned long long>> assigned_nodes;
+
+    /// The indices of the nodes contours can start at.
+    std::vector<unsigned int, container_allocator<unsigned int>> root_indices;
+
+    /// Outline vertices lying on rows of pixel centers.
+    std::vector<outline_crossing, container_allocator<outline_crossing>> crossings;
+
+    /// Whether the first crossing of each outline has been found.
+    std::vector<bool, container_allocator<bool>> found_outlines;
+
+    /// The allocator to use, or nullptr.
+    const ptg_allocator* allocator;
+
+    traced_layer(const ptg_allocator* allocator = nullptr) : vertices(allocator), vertex_offsets(1, 0, allocator), parents(allocator), holes(allocator), node_configurations(allocator), assigned_nodes(allocator), root_indices(allocator), crossings(allocator), found_outlines(allocator), allocator(allocator) {}
+
+    /// Remove all outlines, keeping the allocated memory.
+    void clear() {
+        vertices.clear();
+        vertex_offsets.assign(1, 0);
+        parents.clear();
+        holes.clear();
+    }
+
+    /// Get the number of outlines.
+    unsigned int outline_count() const {
+        return (unsigned int)vertex_offsets.size() - 1;
+    }
+};
 
 /**
  * Trace image using marching squares.
  * @param layer Binary layer.
  * @param layer_width Width of the layer.
  * @param layer_height Height of the layer.
- * @param out_outlines Variable to store resulting outlines.
- * @param out_outline_count Variable to store number of resulting outlines.
- * @todo Improve this. Reduce memory reallocation by tracing contours twice.
+ * @param tile_size Width and height in nodes of the tiles to trace the layer in, or 0 to trace the whole layer at once.
+ * @param thread_count Number of threads to trace tiles on. Ignored when tracing the whole layer at once.
+ * @param out_layer Variable to store resulting outlines.
+ */
+void ptgi_trace_marching_squares(bool* layer, unsigned int layer_width, unsigned int layer_height, unsigned int tile_size, unsigned int thread_count, traced_layer& out_layer);
+
+/**
+ * Trace one layer of a label image using marching squares.
+ * @param labels The layer of every pixel.
+ * @param label The layer to trace.
+ * @param layer_width Width of the layer.
+ * @param layer_height Height of the layer.
+ * @param tile_size Width and height in nodes of the tiles to trace the layer in, or 0 to trace the whole layer at once.
+ * @param thread_count Number of threads to trace tiles on. Ignored when tracing the whole layer at once.
+ * @param out_layer Variable to store resulting outlines.
+ */
+void ptgi_trace_marching_squares_labels(const unsigned short* labels, unsigned short label, unsigned int layer_width, unsigned int layer_height, unsigned int tile_size, unsigned int thread_count, traced_layer& out_layer);
+
+/**
+ * Trace bit-packed layer using marching squares.
+ * Words without set pixels are skipped 64 pixels at a time.
+ * @param layer Binary layer, one bit per pixel. Every row starts on a new 64-bit word and unused bits at the end of rows are 0.
+ * @param words_per_row The number of words per row.
+ * @param layer_width Width of the layer.
+ * @param layer_height Height of the layer.
+ * @param tile_size Width and height in nodes of the tiles to trace the layer in, or 0 to trace the whole layer at once.
+ * @param thread_count Number of threads to trace tiles on. Ignored when tracing the whole layer at once.
+ * @param out_layer Variable to store resulting outlines.
+ */
+void ptgi_trace_marching_squares_packed(const unsigned long long* layer, unsigned int words_per_row, unsigned int layer_width, unsigned int layer_height, unsigned int tile_size, unsigned int thread_count, traced_layer& out_layer);
+
+/**
+ * Start tracing a layer a few rows at a time using marching squares.
+ * @param layer_width Width of the layer.
+ * @return The stream to push rows to.
+ */
+ptg_trace_stream* ptgi_trace_stream_begin(unsigned int layer_width);
+
+/**
+ * Trace the next rows of a layer.
+ * Only the contours that are still open are kept between calls, together with the last row.
+ * @param stream The stream to push rows to.
+ * @param rows Binary layer rows, layer_width values per row.
+ * @param row_count The number of rows.
+ */
+void ptgi_trace_stream_push_rows(ptg_trace_stream* stream, const bool* rows, unsigned int row_count);
+
+/**
+ * Finish tracing a layer. The outlines are identical to tracing the whole layer at once.
+ * @param stream The stream to finish. It is deallocated.
+ * @param out_layer Variable to store resulting outlines.
  */
-void ptgi_trace_marching_squares(bool* layer, unsigned int layer_width, unsigned int layer_height, ptg_outline*& out_outlines, unsigned int& out_outline_count);
+void ptgi_trace_stream_end(ptg_trace_stream* stream, traced_layer& out_layer);
 
 #endif
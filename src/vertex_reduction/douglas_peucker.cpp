@@ -1,9 +1,10 @@
 #include "douglas_peucker.hpp"
 
-#include <cstring>
-#include <stack>
 #include <cmath>
 #include <algorithm>
+#include "remove_outlines.hpp"
+#include "../memory/allocator.hpp"
+#include "../threading/parallel_for.hpp"
 
 // Helper class for linear algebra.
 struct vec2 {
@@ -64,25 +65,19 @@ static float shortest_distance_sqr(const vec2& p, const vec2& v1, const vec2& v2
     return distance_sqr(p, projection);
 }
 
-struct line {
-    unsigned int first_point;
-    unsigned int last_point;
-};
-
 /*
  * Recursively reduce the vertex count in a line using Douglas-Peucker.
  * @param outline The outline to reduce.
- * @param lines The lines to reduce.
- * @param keep The array defining whether points should be kept.
+ * @param lines The lines to reduce, used as a stack.
+ * @param keep Whether points should be kept.
+ * @param tolerance The largest distance from a removed point to the reduced line.
  */
-static void reduce_line(const ptg_outline& outline, std::stack<line>& lines, bool* keep) {
-    // TODO: Make threshold configurable.
-    const float threshold = 1.8f;
-    const float threshold_sqr = threshold * threshold;
+static void reduce_line(const ptg_outline& outline, std::vector<line, container_allocator<line>>& lines, std::vector<bool, container_allocator<bool>>& keep, float tolerance) {
+    const float threshold_sqr = tolerance * tolerance;
 
     while (!lines.empty()) {
-        line l = lines.top();
-        lines.pop();
+        line l = lines.back();
+        lines.pop_back();
 
         // Find point with maximum perpendicular distance.
         float max_distance = 0.0f;
@@ -101,8 +96,8 @@ static void reduce_line(const ptg_outline& outline, std::stack<line>& lines, boo
         // Check whether distance exceeds the threshold.
         if (max_distance > threshold_sqr) {
             // Keep point and call recursively.
-            lines.push({l.first_point, max_index});
-            lines.push({max_index, l.last_point});
+            lines.push_back({l.first_point, max_index});
+            lines.push_back({max_index, l.last_point});
         } else {
             // Remove points.
             unsigned int index = (l.first_point + 1) % (outline.vertex_count - 1);
@@ -114,39 +109,126 @@ static void reduce_line(const ptg_outline& outline, std::stack<line>& lines, boo
     }
 }
 
+// Get the squared distance between two vertices.
+static long long vertex_distance_sqr(const ptg_vec2& a, const ptg_vec2& b) {
+    const long long x_diff = (long long)a.x - b.x;
+    const long long y_diff = (long long)a.y - b.y;
+    return x_diff * x_diff + y_diff * y_diff;
+}
+
+// Get the z component of the cross product between (b - a) and (d - c).
+static long long cross(const ptg_vec2& a, const ptg_vec2& b, const ptg_vec2& c, const ptg_vec2& d) {
+    return ((long long)b.x - a.x) * ((long long)d.y - c.y) - ((long long)b.y - a.y) * ((long long)d.x - c.x);
+}
+
 /*
- * Reduce vertex count in outline using Douglas-Peucker.
- * @param outline The outline to reduce.
+ * Find the two vertices farthest from each other using the convex hull and rotating calipers.
+ * If several pairs are equally far apart, the pair with the lowest first index (and then the lowest last index) is found,
+ * which is the pair a search over all pairs would find.
+ * @param outline The outline to search. The last vertex is the same as the first and is not considered.
+ * @param scratch Scratch memory to use.
+ * @param out_first_point Set to the index of the first point.
+ * @param out_last_point Set to the index of the last point. Larger than out_first_point unless all points are the same.
  */
-static void reduce_outline(ptg_outline& outline) {
-    // Find the two points farthest from each other.
-    unsigned int max_first_point = 0;
-    unsigned int max_last_point = 0;
-    float max_distance = 0.0;
-    for (unsigned int first_point = 0; first_point < outline.vertex_count - 2; ++first_point) {
-        for (unsigned int last_point = first_point + 1; last_point < outline.vertex_count - 1; ++last_point) {
-            const ptg_vec2 p1 = outline.vertices[first_point];
-            const ptg_vec2 p2 = outline.vertices[last_point];
-            const float delta_x = (float)p2.x - p1.x;
-            const float delta_y = (float)p2.y - p1.y;
-            const float distance = delta_x * delta_x + delta_y * delta_y;
-            if (distance > max_distance) {
-                max_distance = distance;
-                max_first_point = first_point;
-                max_last_point = last_point;
+static void find_farthest_points(const ptg_outline& outline, reduction_scratch& scratch, unsigned int& out_first_point, unsigned int& out_last_point) {
+    const ptg_vec2* vertices = outline.vertices;
+    const unsigned int vertex_count = outline.vertex_count - 1;
+
+    out_first_point = 0;
+    out_last_point = 0;
+
+    // Sort vertices by position. Duplicate positions are represented by their lowest index.
+    scratch.sorted.resize(vertex_count);
+    unsigned int* sorted = scratch.sorted.data();
+    for (unsigned int i = 0; i < vertex_count; ++i)
+        sorted[i] = i;
+    std::sort(sorted, sorted + vertex_count, [vertices](unsigned int a, unsigned int b) {
+        if (vertices[a].x != vertices[b].x)
+            return vertices[a].x < vertices[b].x;
+        if (vertices[a].y != vertices[b].y)
+            return vertices[a].y < vertices[b].y;
+        return a < b;
+    });
+    unsigned int unique_count = 0;
+    for (unsigned int i = 0; i < vertex_count; ++i) {
+        if (unique_count == 0 || vertices[sorted[i]].x != vertices[sorted[unique_count - 1]].x || vertices[sorted[i]].y != vertices[sorted[unique_count - 1]].y)
+            sorted[unique_count++] = sorted[i];
+    }
+    if (unique_count < 2)
+        return;
+
+    // Build the convex hull in counterclockwise order using the monotone chain algorithm.
+    // Collinear points are left out so that the hull is strictly convex.
+    scratch.hull.resize(unique_count + 1);
+    unsigned int* hull = scratch.hull.data();
+    unsigned int hull_count = 0;
+    for (unsigned int i = 0; i < unique_count; ++i) {
+        while (hull_count >= 2 && cross(vertices[hull[hull_count - 2]], vertices[hull[hull_count - 1]], vertices[hull[hull_count - 2]], vertices[sorted[i]]) <= 0)
+            --hull_count;
+        hull[hull_count++] = sorted[i];
+    }
+    const unsigned int lower_count = hull_count + 1;
+    for (unsigned int i = unique_count - 1; i-- > 0;) {
+        while (hull_count >= lower_count && cross(vertices[hull[hull_count - 2]], vertices[hull[hull_count - 1]], vertices[hull[hull_count - 2]], vertices[sorted[i]]) <= 0)
+            --hull_count;
+        hull[hull_count++] = sorted[i];
+    }
+    --hull_count;
+
+    // Check a pair of hull vertices, keeping the farthest pair with the lowest indices.
+    long long max_distance = 0;
+    auto check_pair = [&](unsigned int a, unsigned int b) {
+        const long long distance = vertex_distance_sqr(vertices[a], vertices[b]);
+        const unsigned int first_point = std::min(a, b);
+        const unsigned int last_point = std::max(a, b);
+        if (distance > max_distance || (distance == max_distance && distance > 0 && (first_point < out_first_point || (first_point == out_first_point && last_point < out_last_point)))) {
+            max_distance = distance;
+            out_first_point = first_point;
+            out_last_point = last_point;
+        }
+    };
+
+    // Rotating calipers. Visit every antipodal pair of hull vertices.
+    if (hull_count == 2) {
+        check_pair(hull[0], hull[1]);
+    } else if (hull_count > 2) {
+        unsigned int j = 1;
+        for (unsigned int i = 0; i < hull_count; ++i) {
+            const unsigned int next_i = (i + 1) % hull_count;
+            while (cross(vertices[hull[i]], vertices[hull[next_i]], vertices[hull[j]], vertices[hull[(j + 1) % hull_count]]) > 0)
+                j = (j + 1) % hull_count;
+            check_pair(hull[i], hull[j]);
+            check_pair(hull[next_i], hull[j]);
+
+            // Parallel edges have two antipodal vertices on the opposite side.
+            if (cross(vertices[hull[i]], vertices[hull[next_i]], vertices[hull[j]], vertices[hull[(j + 1) % hull_count]]) == 0) {
+                check_pair(hull[i], hull[(j + 1) % hull_count]);
+                check_pair(hull[next_i], hull[(j + 1) % hull_count]);
             }
         }
     }
+}
+
+/*
+ * Reduce vertex count in outline using Douglas-Peucker.
+ * @param outline The outline to reduce.
+ * @param tolerance The largest distance from a removed vertex to the reduced outline.
+ * @param scratch Scratch memory to use. Reused between outlines to avoid reallocating it.
+ */
+static void reduce_outline(ptg_outline& outline, float tolerance, reduction_scratch& scratch) {
+    // Find the two points farthest from each other.
+    unsigned int max_first_point;
+    unsigned int max_last_point;
+    find_farthest_points(outline, scratch, max_first_point, max_last_point);
 
-    // Allocate buffer for whether points should be kept.
-    bool* keep = new bool[outline.vertex_count - 1];
-    memset(keep, 1, outline.vertex_count - 1);
+    // Whether points should be kept.
+    std::vector<bool, container_allocator<bool>>& keep = scratch.keep;
+    keep.assign(outline.vertex_count - 1, true);
 
     // Apply Douglas-Peucker on both lines.
-    std::stack<line> lines;
-    lines.push({max_first_point, max_last_point});
-    lines.push({max_last_point, max_first_point});
-    reduce_line(outline, lines, keep);
+    scratch.lines.push_back({max_first_point, max_last_point});
+    scratch.lines.push_back({max_last_point, max_first_point});
+    reduce_line(outline, scratch.lines, keep, tolerance);
 
     // Generate final outline.
     unsigned int vertex_index = 0;
@@ -156,28 +238,16 @@ static void reduce_outline(ptg_outline& outline) {
     }
     outline.vertices[vertex_index++] = outline.vertices[0];
     outline.vertex_count = vertex_index;
-
-    delete[] keep;
 }
 
-void ptgi_douglas_peucker(ptg_tracing_results* tracing_results) {
-    for (unsigned int layer = 0; layer < tracing_results->layer_count; ++layer) {
-        for (unsigned int outline = 0; outline < tracing_results->outline_counts[layer]; ++outline) {
-            reduce_outline(tracing_results->outlines[layer][outline]);
-        }
+void ptgi_douglas_peucker(ptg_outline* outlines, unsigned int& outline_count, float tolerance, unsigned int thread_count, reduction_scratch* scratch, const ptg_allocator* allocator, bool owns_vertices) {
+    // Outlines are independent, so reduce them on several threads, longest first.
+    ptgi_parallel_for_each_largest_first(outline_count, thread_count, [outlines](unsigned int outline) {
+        return outlines[outline].vertex_count;
+    }, [&](unsigned int outline, unsigned int thread) {
+        reduce_outline(outlines[outline], tolerance, scratch[thread]);
+    });
 
-        // Remove outlines that have been reduced down to a single line.
-        unsigned int outline_count = 0;
-        for (unsigned int outline = 0; outline < tracing_results->outline_counts[layer]; ++outline) {
-            if (tracing_results->outlines[layer][outline].vertex_count > 3) {
-                tracing_results->outlines[layer][outline_count].vertex_count = tracing_results->outlines[layer][outline].vertex_count;
-                tracing_results->outlines[layer][outline_count].vertices = tracing_results->outlines[layer][outline].vertices;
-                ++outline_count;
-            } else {
-                delete[] tracing_results->outlines[layer][outline].vertices;
-            }
-        }
-
-        tracing_results->outline_counts[layer] = outline_count;
-    }
+    // Remove outlines that have been reduced down to a single line.
+    remove_outlines(outlines, outline_count, 4, allocator, owns_vertices, scratch[0]);
 }
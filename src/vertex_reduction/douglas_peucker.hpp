@@ -2,11 +2,18 @@
 #define DOUGLAS_PEUCKER_HPP
 
 #include <photogeo.h>
+#include "reduction_scratch.hpp"
 
 /**
  * Reduce vertex geometry using Douglas-Peucker.
- * @param tracing_results Results from the tracing step.
+ * @param outlines The outlines of a layer.
+ * @param outline_count The number of outlines. Set to the number of remaining outlines.
+ * @param tolerance The largest distance from a removed vertex to the reduced outline.
+ * @param thread_count Number of threads to reduce outlines on. 0 or 1 reduces all outlines on the calling thread.
+ * @param scratch Scratch memory for each thread. Must have at least max(thread_count, 1) elements.
+ * @param allocator Allocator to free removed outlines' vertices with, or nullptr.
+ * @param owns_vertices Whether every outline's vertices are allocated separately and have to be freed when the outline is removed.
  */
-void ptgi_douglas_peucker(ptg_tracing_results* tracing_results);
+void ptgi_douglas_peucker(ptg_outline* outlines, unsigned int& outline_count, float tolerance, unsigned int thread_count, reduction_scratch* scratch, const ptg_allocator* allocator, bool owns_vertices);
 
 #endif
@@ -0,0 +1,60 @@
+#ifndef REDUCTION_SCRATCH_HPP
+#define REDUCTION_SCRATCH_HPP
+
+#include <photogeo.h>
+#include <vector>
+#include "../memory/allocator.hpp"
+
+/**
+ * Part of an outline between two vertices, reduced by Douglas-Peucker.
+ */
+struct line {
+    unsigned int first_point;
+    unsigned int last_point;
+};
+
+/**
+ * Vertex of an outline being reduced by Visvalingam-Whyatt, linked to its neighbors by index.
+ */
+struct vertex {
+    ptg_vec2 position;
+    unsigned int area;
+    unsigned int previous;
+    unsigned int next;
+    unsigned int heap_index;
+    unsigned int outline;
+};
+
+/**
+ * Memory used by one thread while reducing outlines.
+ * The buffers only grow, so reducing again with the same scratch memory reuses it.
+ */
+struct reduction_scratch {
+    /// Lines left to reduce with Douglas-Peucker, used as a stack.
+    std::vector<line, container_allocator<line>> lines;
+
+    /// Vertex indices sorted by position, when finding the vertices farthest from each other.
+    std::vector<unsigned int, container_allocator<unsigned int>> sorted;
+
+    /// Vertex indices of the convex hull, when finding the vertices farthest from each other.
+    std::vector<unsigned int, container_allocator<unsigned int>> hull;
+
+    /// Whether Douglas-Peucker keeps each vertex.
+    std::vector<bool, container_allocator<bool>> keep;
+
+    /// Vertices being reduced by Visvalingam-Whyatt or to a vertex budget.
+    std::vector<vertex, container_allocator<vertex>> vertices;
+
+    /// Heap of the vertices, ordered by area.
+    std::vector<unsigned int, container_allocator<unsigned int>> heap_indices;
+
+    /// Index of the first vertex of each outline, when reducing to a vertex budget.
+    std::vector<unsigned int, container_allocator<unsigned int>> first_vertices;
+
+    /// New index of each outline, when removing outlines.
+    std::vector<unsigned int, container_allocator<unsigned int>> new_indices;
+
+    reduction_scratch(const ptg_allocator* allocator = nullptr) : lines(allocator), sorted(allocator), hull(allocator), keep(allocator), vertices(allocator), heap_indices(allocator), first_vertices(allocator), new_indices(allocator) {}
+};
+
+#endif
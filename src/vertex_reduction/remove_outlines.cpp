@@ -0,0 +1,33 @@
+#include "remove_outlines.hpp"
+
+#include "../memory/allocator.hpp"
+
+void remove_outlines(ptg_outline* outlines, unsigned int& outline_count, unsigned int min_vertex_count, const ptg_allocator* allocator, bool free_vertices, reduction_scratch& scratch) {
+    // Find the new index of every kept outline.
+    std::vector<unsigned int, container_allocator<unsigned int>>& new_indices = scratch.new_indices;
+    new_indices.assign(outline_count, PTG_NO_PARENT);
+    unsigned int kept_count = 0;
+    for (unsigned int outline = 0; outline < outline_count; ++outline) {
+        if (outlines[outline].vertex_count >= min_vertex_count)
+            new_indices[outline] = kept_count++;
+    }
+
+    // Point kept outlines at their closest kept ancestor.
+    for (unsigned int outline = 0; outline < outline_count; ++outline) {
+        unsigned int parent = outlines[outline].parent;
+        while (parent != PTG_NO_PARENT && new_indices[parent] == PTG_NO_PARENT)
+            parent = outlines[parent].parent;
+        if (new_indices[outline] != PTG_NO_PARENT)
+            outlines[outline].parent = (parent != PTG_NO_PARENT) ? new_indices[parent] : PTG_NO_PARENT;
+    }
+
+    // Compact the outlines.
+    for (unsigned int outline = 0; outline < outline_count; ++outline) {
+        if (new_indices[outline] != PTG_NO_PARENT)
+            outlines[new_indices[outline]] = outlines[outline];
+        else if (free_vertices)
+            ptgi_free(allocator, outlines[outline].vertices);
+    }
+
+    outline_count = kept_count;
+}
@@ -0,0 +1,19 @@
+#ifndef REMOVE_OUTLINES_HPP
+#define REMOVE_OUTLINES_HPP
+
+#include <photogeo.h>
+#include "reduction_scratch.hpp"
+
+/**
+ * Remove outlines that have been reduced too far, keeping the hierarchy of the remaining outlines.
+ * Outlines enclosed by a removed outline get the removed outline's parent.
+ * @param outlines The outlines of a layer.
+ * @param outline_count The number of outlines. Set to the number of remaining outlines.
+ * @param min_vertex_count The fewest vertices an outline needs to be kept.
+ * @param allocator Allocator the vertices of the outlines were allocated with, or nullptr.
+ * @param free_vertices Whether to free the vertices of removed outlines.
+ * @param scratch Scratch memory to use.
+ */
+void remove_outlines(ptg_outline* outlines, unsigned int& outline_count, unsigned int min_vertex_count, const ptg_allocator* allocator, bool free_vertices, reduction_scratch& scratch);
+
+#endif
@@ -1,26 +1,97 @@
 #include "visvalingam_whyatt.hpp"
 
+#include <algorithm>
 #include <cmath>
-#include <limits>
+#include "remove_outlines.hpp"
+#include "../memory/allocator.hpp"
+#include "../threading/parallel_for.hpp"
 
-struct vertex {
-    ptg_vec2 position;
-    unsigned int area;
-    vertex* previous;
-    vertex* next;
+// Neighbor of the first and last vertex of an outline when reducing to a budget.
+static const unsigned int no_vertex = 0xFFFFFFFFu;
+
+/*
+ * Min-heap of vertex indices, ordered by area.
+ * Vertices with equal area are ordered by index, so vertices are removed in the same order as when scanning the outline.
+ * Every vertex stores its position in the heap so its area can be updated in place.
+ */
+struct vertex_heap {
+    vertex* vertices;
+    unsigned int* indices;
+    unsigned int size;
+
+    // Whether vertex a should be removed before vertex b.
+    bool less(unsigned int a, unsigned int b) const {
+        return vertices[a].area < vertices[b].area || (vertices[a].area == vertices[b].area && a < b);
+    }
+
+    // Place a vertex at a position in the heap.
+    void place(unsigned int heap_index, unsigned int vertex_index) {
+        indices[heap_index] = vertex_index;
+        vertices[vertex_index].heap_index = heap_index;
+    }
+
+    // Move the vertex at a position towards the root until the heap is ordered.
+    void sift_up(unsigned int heap_index) {
+        const unsigned int vertex_index = indices[heap_index];
+        while (heap_index > 0) {
+            const unsigned int parent = (heap_index - 1) / 2;
+            if (!less(vertex_index, indices[parent]))
+                break;
+            place(heap_index, indices[parent]);
+            heap_index = parent;
+        }
+        place(heap_index, vertex_index);
+    }
+
+    // Move the vertex at a position towards the leaves until the heap is ordered.
+    void sift_down(unsigned int heap_index) {
+        const unsigned int vertex_index = indices[heap_index];
+        while (true) {
+            unsigned int child = heap_index * 2 + 1;
+            if (child >= size)
+                break;
+            if (child + 1 < size && less(indices[child + 1], indices[child]))
+                ++child;
+            if (!less(indices[child], vertex_index))
+                break;
+            place(heap_index, indices[child]);
+            heap_index = child;
+        }
+        place(heap_index, vertex_index);
+    }
+
+    // Restore heap order after a vertex's area has changed.
+    void update(unsigned int vertex_index) {
+        sift_up(vertices[vertex_index].heap_index);
+        sift_down(vertices[vertex_index].heap_index);
+    }
+
+    // Remove the vertex with the smallest area.
+    void pop() {
+        --size;
+        if (size > 0) {
+            place(0, indices[size]);
+            sift_down(0);
+        }
+    }
 };
 
 /*
  * Calculate the area*2 of a vertex.
- * @param v Vertex to calculate area of.
+ * @param vertices The vertices of the outline.
+ * @param v Index of the vertex to calculate area of.
  * @return The area of the vertex.
  */
-static unsigned int calculate_double_area(vertex* v) {
+static unsigned int calculate_double_area(const vertex* vertices, unsigned int v) {
+    const ptg_vec2& position = vertices[v].position;
+    const ptg_vec2& previous = vertices[vertices[v].previous].position;
+    const ptg_vec2& next = vertices[vertices[v].next].position;
+
     // Calculate vectors from v to other points in triangle.
-    const long ux = (long)v->previous->position.x - v->position.x;
-    const long uy = (long)v->previous->position.y - v->position.y;
-    const long vx = (long)v->next->position.x - v->position.x;
-    const long vy = (long)v->next->position.y - v->position.y;
+    const long ux = (long)previous.x - position.x;
+    const long uy = (long)previous.y - position.y;
+    const long vx = (long)next.x - position.x;
+    const long vy = (long)next.y - position.y;
 
     return std::abs(ux * vy - uy * vx);
 }
@@ -28,88 +99,184 @@ static unsigned int calculate_double_area(vertex* v) {
 /*
  * Reduce vertex count in outline using Visvalingam-Whyatt.
  * @param outline The outline to reduce.
+ * @param tolerance The largest area of the triangle a removed vertex forms with its neighbors.
+ * @param scratch Scratch memory to use.
  */
-static void reduce_outline(ptg_outline& outline) {
-    // Initialize vertices.
-    vertex* first = nullptr;
-    vertex** current = &first;
-    vertex* previous = first;
+static void reduce_outline(ptg_outline& outline, float tolerance, reduction_scratch& scratch) {
+    // The first and last vertex are never removed.
+    if (outline.vertex_count < 3)
+        return;
+
+    const unsigned int last = outline.vertex_count - 1;
+
+    // Initialize vertices. They are stored contiguously and linked as a list by index.
+    scratch.vertices.resize(outline.vertex_count);
+    vertex* vertices = scratch.vertices.data();
     for (unsigned int i = 0; i < outline.vertex_count; ++i) {
-        *current = new vertex;
-        (*current)->position = outline.vertices[i];
-        (*current)->previous = previous;
-        (*current)->next = nullptr;
+        vertices[i].position = outline.vertices[i];
+        vertices[i].previous = i - 1;
+        vertices[i].next = i + 1;
+    }
 
-        previous = *current;
-        current = &(*current)->next;
+    // Calculate initial areas (except for first and last vertex) and build the heap.
+    vertex_heap heap;
+    heap.vertices = vertices;
+    scratch.heap_indices.resize(last - 1);
+    heap.indices = scratch.heap_indices.data();
+    heap.size = last - 1;
+    for (unsigned int i = 1; i < last; ++i) {
+        vertices[i].area = calculate_double_area(vertices, i);
+        heap.place(i - 1, i);
     }
+    for (unsigned int i = heap.size / 2; i > 0; --i)
+        heap.sift_down(i - 1);
+
+    // Remove vertices with smallest area while not larger than the tolerance. Areas are stored doubled.
+    const double threshold = 2.0 * tolerance;
+    while (heap.size > 0 && vertices[heap.indices[0]].area <= threshold) {
+        const vertex& smallest_vertex = vertices[heap.indices[0]];
+        heap.pop();
 
-    // Calculate initial areas (except for first and last vertex).
-    for (vertex* node = first->next; node->next != nullptr; node = node->next)
-        node->area = calculate_double_area(node);
-
-    while (true) {
-        // Find vertex with smallest area.
-        unsigned int smallest_area = std::numeric_limits<unsigned int>::max();
-        vertex* smallest_vertex = nullptr;
-        for (vertex* node = first->next; node->next != nullptr; node = node->next) {
-            if (node->area < smallest_area) {
-                smallest_area = node->area;
-                smallest_vertex = node;
-            }
+        vertices[smallest_vertex.previous].next = smallest_vertex.next;
+        vertices[smallest_vertex.next].previous = smallest_vertex.previous;
+
+        // Recalculate area of neighbor vertices.
+        if (smallest_vertex.previous != 0) {
+            vertices[smallest_vertex.previous].area = calculate_double_area(vertices, smallest_vertex.previous);
+            heap.update(smallest_vertex.previous);
         }
 
-        // Remove it if smaller than certain value.
-        // TODO: Make threshold configurable.
-        const unsigned int threshold = 20 * 2;
-        if (smallest_area <= threshold) {
-            smallest_vertex->previous->next = smallest_vertex->next;
-            smallest_vertex->next->previous = smallest_vertex->previous;
+        if (smallest_vertex.next != last) {
+            vertices[smallest_vertex.next].area = calculate_double_area(vertices, smallest_vertex.next);
+            heap.update(smallest_vertex.next);
+        }
+    }
 
-            // Recalculate area of neighbor vertices.
-            if (smallest_vertex->previous->previous != nullptr)
-                smallest_vertex->previous->area = calculate_double_area(smallest_vertex->previous);
+    // Store output vertices.
+    outline.vertex_count = 0;
+    for (unsigned int i = 0; i != last; i = vertices[i].next)
+        outline.vertices[outline.vertex_count++] = vertices[i].position;
+    outline.vertices[outline.vertex_count++] = vertices[last].position;
+}
 
-            if (smallest_vertex->next->next != nullptr)
-                smallest_vertex->next->area = calculate_double_area(smallest_vertex->next);
+void ptgi_visvalingam_whyatt(ptg_outline* outlines, unsigned int& outline_count, float tolerance, unsigned int thread_count, reduction_scratch* scratch, const ptg_allocator* allocator, bool owns_vertices) {
+    // Outlines are independent, so reduce them on several threads, longest first.
+    ptgi_parallel_for_each_largest_first(outline_count, thread_count, [outlines](unsigned int outline) {
+        return outlines[outline].vertex_count;
+    }, [&](unsigned int outline, unsigned int thread) {
+        reduce_outline(outlines[outline], tolerance, scratch[thread]);
+    });
 
-            delete smallest_vertex;
-        } else {
-            break;
+    // Remove outlines that have been reduced down to a single point.
+    remove_outlines(outlines, outline_count, 3, allocator, owns_vertices, scratch[0]);
+}
+
+/*
+ * Remove the vertices forming the smallest triangles with their neighbors until the outlines have at most a number of vertices in total.
+ * An outline with no more than four vertices (a triangle) is removed entirely instead, by setting its vertex count to 0.
+ * @param outlines The outlines to reduce.
+ * @param outline_count The number of outlines.
+ * @param max_vertex_count The most vertices the outlines may have in total.
+ * @param vertices Buffer to hold the vertices of the outlines.
+ * @param heap_indices Buffer to hold the heap of the vertices.
+ * @param first_vertices Buffer to hold the index of the first vertex of each outline.
+ */
+static void reduce_to_budget(ptg_outline* outlines, unsigned int outline_count, unsigned int max_vertex_count, vertex* vertices, unsigned int* heap_indices, unsigned int* first_vertices) {
+    vertex_heap heap;
+    heap.vertices = vertices;
+    heap.indices = heap_indices;
+    heap.size = 0;
+
+    // Initialize the vertices of all outlines, linked as one list per outline.
+    unsigned int vertex_count = 0;
+    for (unsigned int outline = 0; outline < outline_count; ++outline) {
+        const unsigned int first = vertex_count;
+        first_vertices[outline] = first;
+        for (unsigned int i = 0; i < outlines[outline].vertex_count; ++i) {
+            vertex& v = vertices[vertex_count++];
+            v.position = outlines[outline].vertices[i];
+            v.previous = (i > 0) ? first + i - 1 : no_vertex;
+            v.next = (i + 1 < outlines[outline].vertex_count) ? first + i + 1 : no_vertex;
+            v.outline = outline;
+        }
+
+        // The first and last vertex are never removed.
+        for (unsigned int i = first + 1; i + 1 < vertex_count; ++i) {
+            vertices[i].area = calculate_double_area(vertices, i);
+            heap.place(heap.size++, i);
+        }
+    }
+    for (unsigned int i = heap.size / 2; i > 0; --i)
+        heap.sift_down(i - 1);
+
+    while (vertex_count > max_vertex_count && heap.size > 0) {
+        const vertex& smallest_vertex = vertices[heap.indices[0]];
+        heap.pop();
+
+        // Skip the remaining vertices of removed outlines.
+        ptg_outline& outline = outlines[smallest_vertex.outline];
+        if (outline.vertex_count == 0)
+            continue;
+
+        // Removing a vertex from a triangle would leave a line, so remove the whole outline.
+        if (outline.vertex_count <= 4) {
+            vertex_count -= outline.vertex_count;
+            outline.vertex_count = 0;
+            continue;
+        }
+
+        vertices[smallest_vertex.previous].next = smallest_vertex.next;
+        vertices[smallest_vertex.next].previous = smallest_vertex.previous;
+        --outline.vertex_count;
+        --vertex_count;
+
+        // Recalculate area of neighbor vertices.
+        if (vertices[smallest_vertex.previous].previous != no_vertex) {
+            vertices[smallest_vertex.previous].area = calculate_double_area(vertices, smallest_vertex.previous);
+            heap.update(smallest_vertex.previous);
+        }
+
+        if (vertices[smallest_vertex.next].next != no_vertex) {
+            vertices[smallest_vertex.next].area = calculate_double_area(vertices, smallest_vertex.next);
+            heap.update(smallest_vertex.next);
         }
     }
 
     // Store output vertices.
-    outline.vertex_count = 0;
-    for (vertex* node = first; node != nullptr; node = node->next)
-        outline.vertices[outline.vertex_count++] = node->position;
-
-    // Cleanup.
-    while (first->next != nullptr) {
-        vertex* next = first->next;
-        delete first;
-        first = next;
+    for (unsigned int outline = 0; outline < outline_count; ++outline) {
+        if (outlines[outline].vertex_count == 0)
+            continue;
+
+        unsigned int count = 0;
+        for (unsigned int i = first_vertices[outline]; i != no_vertex; i = vertices[i].next)
+            outlines[outline].vertices[count++] = vertices[i].position;
     }
 }
 
-void ptgi_visvalingam_whyatt(ptg_tracing_results* tracing_results) {
-    for (unsigned int layer = 0; layer < tracing_results->layer_count; ++layer) {
-        for (unsigned int outline = 0; outline < tracing_results->outline_counts[layer]; ++outline) {
-            reduce_outline(tracing_results->outlines[layer][outline]);
-        }
+void ptgi_reduce_to_vertex_budget(ptg_outline* outlines, unsigned int& outline_count, unsigned int max_outline_vertex_count, unsigned int max_layer_vertex_count, reduction_scratch& scratch, const ptg_allocator* allocator, bool owns_vertices) {
+    unsigned int total_vertex_count = 0;
+    for (unsigned int outline = 0; outline < outline_count; ++outline)
+        total_vertex_count += outlines[outline].vertex_count;
+
+    scratch.vertices.resize(total_vertex_count);
+    scratch.heap_indices.resize(total_vertex_count);
+    scratch.first_vertices.resize(outline_count);
+    vertex* vertices = scratch.vertices.data();
+    unsigned int* heap_indices = scratch.heap_indices.data();
+    unsigned int* first_vertices = scratch.first_vertices.data();
 
-        // Remove outlines that have been reduced down to a single point.
-        unsigned int outline_count = 0;
-        for (unsigned int outline = 0; outline < tracing_results->outline_counts[layer]; ++outline) {
-            if (tracing_results->outlines[layer][outline].vertex_count > 2) {
-                tracing_results->outlines[layer][outline_count].vertex_count = tracing_results->outlines[layer][outline].vertex_count;
-                tracing_results->outlines[layer][outline_count].vertices = tracing_results->outlines[layer][outline].vertices;
-                ++outline_count;
-            } else {
-                delete[] tracing_results->outlines[layer][outline].vertices;
-            }
+    // Reduce each outline on its own to the outline budget. Outlines are never removed since they can always be kept as triangles.
+    if (max_outline_vertex_count > 0) {
+        max_outline_vertex_count = std::max(max_outline_vertex_count, 4u);
+        for (unsigned int outline = 0; outline < outline_count; ++outline) {
+            if (outlines[outline].vertex_count > max_outline_vertex_count)
+                reduce_to_budget(&outlines[outline], 1, max_outline_vertex_count, vertices, heap_indices, first_vertices);
         }
+    }
 
-        tracing_results->outline_counts[layer] = outline_count;
+    // Reduce all outlines together to the layer budget, removing the smallest outlines if needed.
+    if (max_layer_vertex_count > 0) {
+        reduce_to_budget(outlines, outline_count, max_layer_vertex_count, vertices, heap_indices, first_vertices);
+        remove_outlines(outlines, outline_count, 1, allocator, owns_vertices, scratch);
     }
 }
@@ -2,14 +2,32 @@
 #define VISVALINGAM_WHYATT_HPP
 
 #include <photogeo.h>
+#include "reduction_scratch.hpp"
 
 /**
  * Reduce vertex geometry using Visvalingam-Whyatt.
- * @param tracing_results Results from the tracing step.
- * @todo Optimize using min-heap.
- * @todo Handle complete removal of outline.
- * @todo Look into resizing result array (realloc).
+ * Vertices are removed in place, leaving the vertex arrays at their original size. Outlines reduced to a single point are removed.
+ * @param outlines The outlines of a layer.
+ * @param outline_count The number of outlines. Set to the number of remaining outlines.
+ * @param tolerance The largest area of the triangle a removed vertex forms with its neighbors.
+ * @param thread_count Number of threads to reduce outlines on. 0 or 1 reduces all outlines on the calling thread.
+ * @param scratch Scratch memory for each thread. Must have at least max(thread_count, 1) elements.
+ * @param allocator Allocator to free removed outlines' vertices with, or nullptr.
+ * @param owns_vertices Whether every outline's vertices are allocated separately and have to be freed when the outline is removed.
  */
-void ptgi_visvalingam_whyatt(ptg_tracing_results* tracing_results);
+void ptgi_visvalingam_whyatt(ptg_outline* outlines, unsigned int& outline_count, float tolerance, unsigned int thread_count, reduction_scratch* scratch, const ptg_allocator* allocator, bool owns_vertices);
+
+/**
+ * Reduce vertex geometry to a vertex budget.
+ * Vertices are removed in the same order as Visvalingam-Whyatt, until the budget is met rather than until reaching a tolerance.
+ * @param outlines The outlines of a layer.
+ * @param outline_count The number of outlines. Set to the number of remaining outlines.
+ * @param max_outline_vertex_count The most vertices each outline may have, or 0 for no limit. Values below 4 (a triangle) are treated as 4.
+ * @param max_layer_vertex_count The most vertices all outlines may have together, or 0 for no limit. Outlines reduced to triangles are removed, smallest first.
+ * @param scratch Scratch memory to use.
+ * @param allocator Allocator to free removed outlines' vertices with, or nullptr.
+ * @param owns_vertices Whether every outline's vertices are allocated separately and have to be freed when the outline is removed.
+ */
+void ptgi_reduce_to_vertex_budget(ptg_outline* outlines, unsigned int& outline_count, unsigned int max_outline_vertex_count, unsigned int max_layer_vertex_count, reduction_scratch& scratch, const ptg_allocator* allocator, bool owns_vertices);
 
 #endif
@@ -31,6 +31,15 @@ int main(int argc, const char* argv[]) {
     std::vector<ptg_color> foreground_colors;
     const char* log_filename = "";
     unsigned int iteration_count = 1;
+    unsigned int thread_count = 1;
+    unsigned int tile_size = 0;
+    ptg_gaussian_blur_parameters gaussian_blur_parameters = { PTG_DEFAULT_GAUSSIAN_BLUR_SIGMA };
+    ptg_bilateral_filter_parameters bilateral_filter_parameters = { PTG_DEFAULT_BILATERAL_FILTER_SIGMA_COLOR, PTG_DEFAULT_BILATERAL_FILTER_SIGMA_SPACE, 0 };
+    int bilateral_filter_diameter = 0;
+    ptg_median_filter_parameters median_filter_parameters = { PTG_DEFAULT_MEDIAN_FILTER_APERTURE };
+    ptg_kuwahara_filter_parameters kuwahara_filter_parameters = { PTG_DEFAULT_KUWAHARA_FILTER_RADIUS };
+    bool cache_colors = false;
+    bool fast_color_conversion = false;
     bool output_image_processing = false;
     bool output_quantization = false;
     bool output_tracing = false;
@@ -43,6 +52,9 @@ int main(int argc, const char* argv[]) {
     ptg_quantization_method quantization_method = PTG_EUCLIDEAN_LINEAR;
     ptg_tracing_method tracing_method = PTG_MARCHING_SQUARES;
     ptg_vertex_reduction_method vertex_reduction_method = PTG_NO_VERTEX_REDUCTION;
+    float vertex_reduction_tolerance = -1.0f;
+    unsigned int max_outline_vertex_count = 0;
+    unsigned int max_layer_vertex_count = 0;
 
     for (int argument = 1; argument < argc; ++argument) {
         // All arguments start with -.
@@ -95,6 +107,46 @@ int main(int argc, const char* argv[]) {
             else if (argv[argument][1] == 'l' && argv[argument][2] == 'i' && argc > argument + 1)
                 iteration_count = std::stoi(argv[++argument]);
 
+            // Tile size.
+            else if (argv[argument][1] == 't' && argv[argument][2] == 's' && argc > argument + 1)
+                tile_size = std::stoi(argv[++argument]);
+
+            // Thread count.
+            else if (argv[argument][1] == 'j' && argc > argument + 1)
+                thread_count = std::stoi(argv[++argument]);
+
+            // Cache quantization results per color.
+            else if (argv[argument][1] == 'q' && argv[argument][2] == 'c')
+                cache_colors = true;
+
+            // Fast color conversion during quantization.
+            else if (argv[argument][1] == 'q' && argv[argument][2] == 'f')
+                fast_color_conversion = true;
+
+            // Gaussian blur sigma.
+            else if (argv[argument][1] == 'p' && argv[argument][2] == 'g' && argc > argument + 1)
+                gaussian_blur_parameters.sigma = std::stof(argv[++argument]);
+
+            // Bilateral filter sigma color.
+            else if (argv[argument][1] == 'p' && argv[argument][2] == 'c' && argc > argument + 1)
+                bilateral_filter_parameters.sigma_color = std::stof(argv[++argument]);
+
+            // Bilateral filter sigma space.
+            else if (argv[argument][1] == 'p' && argv[argument][2] == 's' && argc > argument + 1)
+                bilateral_filter_parameters.sigma_space = std::stof(argv[++argument]);
+
+            // Bilateral filter diameter.
+            else if (argv[argument][1] == 'p' && argv[argument][2] == 'd' && argc > argument + 1)
+                bilateral_filter_diameter = std::stoi(argv[++argument]);
+
+            // Median filter aperture.
+            else if (argv[argument][1] == 'p' && argv[argument][2] == 'a' && argc > argument + 1)
+                median_filter_parameters.aperture = std::stoi(argv[++argument]);
+
+            // Kuwahara filter radius.
+            else if (argv[argument][1] == 'p' && argv[argument][2] == 'k' && argc > argument + 1)
+                kuwahara_filter_parameters.radius = std::stoi(argv[++argument]);
+
             // Image processing methods.
             // Gaussian blur.
             else if (argv[argument][1] == 'p' && (argv[argument][2] - '0') == PTG_GAUSSIAN_BLUR)
@@ -138,6 +190,18 @@ int main(int argc, const char* argv[]) {
             else if (argv[argument][1] == 't' && (argv[argument][2] - '0') == PTG_MARCHING_SQUARES)
                 tracing_method = PTG_MARCHING_SQUARES;
 
+            // Vertex reduction tolerance.
+            else if (argv[argument][1] == 'v' && argv[argument][2] == 't' && argc > argument + 1)
+                vertex_reduction_tolerance = std::stof(argv[++argument]);
+
+            // Vertex budget per outline.
+            else if (argv[argument][1] == 'v' && argv[argument][2] == 'o' && argc > argument + 1)
+                max_outline_vertex_count = std::stoi(argv[++argument]);
+
+            // Vertex budget per layer.
+            else if (argv[argument][1] == 'v' && argv[argument][2] == 'l' && argc > argument + 1)
+                max_layer_vertex_count = std::stoi(argv[++argument]);
+
             // Vertex reduction method.
             // Don't perform any vertex reduction.
             else if (argv[argument][1] == 'v' && (argv[argument][2] - '0') == PTG_NO_VERTEX_REDUCTION)
@@ -177,20 +241,67 @@ int main(int argc, const char* argv[]) {
         std::cout << "  -lo Specify filename of log file." << std::endl;
         std::cout << "  -li Specify how many times to iterate test." << std::endl
                   << "      Integer values only." << std::endl;
+        std::cout << "  -j  Specify how many threads to use." << std::endl
+                  << "      Integer values only." << std::endl;
+        std::cout << "  -ts Specify the size of the tiles to trace layers in." << std::endl
+                  << "      Integer values only. 0 traces whole layers." << std::endl;
         std::cout << "  -p0 Gaussian blur. Image processing method." << std::endl;
         std::cout << "  -p1 Bilateral filter. Image processing method." << std::endl;
         std::cout << "  -p2 Median filter. Image processing method." << std::endl;
         std::cout << "  -p3 Kuwahara filter. Image processing method." << std::endl;
+        std::cout << "  -pg Specify the standard deviation of the Gaussian blur." << std::endl
+                  << "      Must be greater than 0. Defaults to 1.5." << std::endl;
+        std::cout << "  -pc Specify the standard deviation in color space of the bilateral filter." << std::endl
+                  << "      Defaults to 50." << std::endl;
+        std::cout << "  -ps Specify the standard deviation in coordinate space of the bilateral filter." << std::endl
+                  << "      Defaults to 5." << std::endl;
+        std::cout << "  -pd Specify the diameter of the bilateral filter." << std::endl
+                  << "      Non-negative integer values only. Defaults to 0, which derives it from -ps." << std::endl;
+        std::cout << "  -pa Specify the aperture size of the median filter." << std::endl
+                  << "      Odd integer values only. Defaults to 3." << std::endl;
+        std::cout << "  -pk Specify the radius of the Kuwahara filter." << std::endl
+                  << "      Integer values only. Defaults to 2." << std::endl;
         std::cout << "  -q0 Euclidean distance in sRGB space. Quantization method." << std::endl;
         std::cout << "  -q1 Euclidean distance in linear RGB space. Quantization method." << std::endl;
         std::cout << "  -q2 CIE76. Quantization method." << std::endl;
         std::cout << "  -q3 CIE94. Quantization method." << std::endl;
         std::cout << "  -q4 CIE2000. Quantization method." << std::endl;
+        std::cout << "  -qc Cache quantization results per unique color." << std::endl;
+        std::cout << "  -qf Use fast approximate color conversion for the CIE quantization methods." << std::endl;
         std::cout << "  -t0 Marching squares. Tracing method." << std::endl;
         std::cout << "  -v0 Don't perform any vertex reduction. Vertex reduction method." << std::endl;
         std::cout << "  -v1 Douglas-Peucker. Vertex reduction method." << std::endl;
         std::cout << "  -v2 Visvalingam-Whyatt. Vertex reduction method." << std::endl;
+        std::cout << "  -vt Specify the vertex reduction tolerance." << std::endl
+                  << "      Distance for Douglas-Peucker, area for Visvalingam-Whyatt." << std::endl;
+        std::cout << "  -vo Specify the most vertices each outline may have." << std::endl
+                  << "      Integer values only. 0 means no limit." << std::endl;
+        std::cout << "  -vl Specify the most vertices each layer may have." << std::endl
+                  << "      Integer values only. 0 means no limit." << std::endl;
+
+        return 0;
+    }
+
+    // Use the default tolerance of the vertex reduction method unless one was given.
+    if (vertex_reduction_tolerance < 0.0f)
+        vertex_reduction_tolerance = vertex_reduction_method == PTG_VISVALINGAM_WHYATT ? PTG_DEFAULT_VISVALINGAM_WHYATT_TOLERANCE : PTG_DEFAULT_DOUGLAS_PEUCKER_TOLERANCE;
+
+    // The Gaussian blur needs a positive standard deviation.
+    if (gaussian_blur_parameters.sigma <= 0.0f) {
+        std::cout << "The standard deviation of the Gaussian blur must be greater than 0." << std::endl;
+        return 0;
+    }
+
+    // The diameter of the bilateral filter can't be negative.
+    if (bilateral_filter_diameter < 0) {
+        std::cout << "The diameter of the bilateral filter can't be negative." << std::endl;
+        return 0;
+    }
+    bilateral_filter_parameters.diameter = bilateral_filter_diameter;
 
+    // The median filter needs an odd aperture greater than 1.
+    if (median_filter_parameters.aperture < 3 || median_filter_parameters.aperture % 2 == 0) {
+        std::cout << "The aperture of the median filter must be odd and greater than 1." << std::endl;
         return 0;
     }
 
@@ -248,18 +359,33 @@ int main(int argc, const char* argv[]) {
         ptg_image_processing_parameters image_processing_parameters;
         image_processing_parameters.method_count = image_processing_methods.size();
         image_processing_parameters.methods = image_processing_methods.data();
+        image_processing_parameters.gaussian_blur_parameters = gaussian_blur_parameters;
+        image_processing_parameters.bilateral_filter_parameters = bilateral_filter_parameters;
+        image_processing_parameters.median_filter_parameters = median_filter_parameters;
+        image_processing_parameters.kuwahara_filter_parameters = kuwahara_filter_parameters;
+        image_processing_parameters.thread_count = thread_count;
 
         // Quantization parameters.
         ptg_quantization_parameters quantization_parameters;
         quantization_parameters.quantization_method = quantization_method;
+        quantization_parameters.thread_count = thread_count;
+        quantization_parameters.cache_colors = cache_colors;
+        quantization_parameters.fast_color_conversion = fast_color_conversion;
 
         // Tracing parameters.
         ptg_tracing_parameters tracing_parameters;
         tracing_parameters.tracing_method = tracing_method;
+        tracing_parameters.thread_count = thread_count;
+        tracing_parameters.tile_size = tile_size;
 
         // Vertex reduction parameters.
         ptg_vertex_reduction_parameters vertex_reduction_parameters;
         vertex_reduction_parameters.vertex_reduction_method = vertex_reduction_method;
+        vertex_reduction_parameters.tolerance = vertex_reduction_tolerance;
+        vertex_reduction_parameters.layer_tolerances = nullptr;
+        vertex_reduction_parameters.max_outline_vertex_count = max_outline_vertex_count;
+        vertex_reduction_parameters.max_layer_vertex_count = max_layer_vertex_count;
+        vertex_reduction_parameters.thread_count = thread_count;
 
         // Generation parameters.
         ptg_generation_parameters generation_parameters;
@@ -268,6 +394,9 @@ int main(int argc, const char* argv[]) {
         generation_parameters.quantization_parameters = &quantization_parameters;
         generation_parameters.tracing_parameters = &tracing_parameters;
         generation_parameters.vertex_reduction_parameters = &vertex_reduction_parameters;
+        generation_parameters.allocator = nullptr;
+        generation_parameters.context = nullptr;
+        generation_parameters.fused_band_height = 0;
 
         // Image processing.
         {
@@ -165,6 +165,10 @@ void read_svg(const char* filename, ptg_tracing_results* results, ptg_color** co
             outline.vertices = new ptg_vec2[vertices.size()];
             memcpy(outline.vertices, vertices.data(), vertices.size() * sizeof(ptg_vec2));
 
+            // The hierarchy isn't stored in SVG files.
+            outline.parent = PTG_NO_PARENT;
+            outline.hole = false;
+
             layer.outlines.push_back(outline);
 
             path = path->NextSiblingElement("path");